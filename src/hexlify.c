@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include "kms_alloc.h"
+
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -23,7 +25,7 @@
 char *
 hexlify (const uint8_t *buf, size_t len)
 {
-   char *hex_chars = malloc (len * 2 + 1);
+   char *hex_chars = kms_malloc (len * 2 + 1);
    char *p = hex_chars;
    size_t i;
 
@@ -43,7 +45,7 @@ unhexlify (const char *hex_chars, size_t *len)
    uint8_t *pos;
 
    *len = strlen (hex_chars) / 2;
-   buf = malloc (*len);
+   buf = kms_malloc (*len);
    pos = buf;
 
    while (*hex_chars) {
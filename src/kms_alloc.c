@@ -0,0 +1,137 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_crypto.h"
+#include "kms_message/kms_message.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *
+libc_malloc (size_t size, void *ctx)
+{
+   (void) ctx;
+   return malloc (size);
+}
+
+static void *
+libc_realloc (void *ptr, size_t size, void *ctx)
+{
+   (void) ctx;
+   return realloc (ptr, size);
+}
+
+static void
+libc_free (void *ptr, void *ctx)
+{
+   (void) ctx;
+   free (ptr);
+}
+
+static kms_allocator_t installed = {libc_malloc, libc_realloc, libc_free, NULL};
+
+bool
+kms_message_init_with_allocator (kms_crypto_backend_t backend,
+                                 const kms_allocator_t *allocator)
+{
+   if (allocator &&
+       (!allocator->malloc || !allocator->realloc || !allocator->free)) {
+      return false;
+   }
+
+   /* free what the crypto backend cached with the old allocator */
+   kms_crypto_cleanup ();
+   if (allocator) {
+      installed = *allocator;
+   } else {
+      installed.malloc = libc_malloc;
+      installed.realloc = libc_realloc;
+      installed.free = libc_free;
+      installed.ctx = NULL;
+   }
+
+   return kms_message_init_with_crypto (backend);
+}
+
+void
+kms_message_free (void *ptr)
+{
+   kms_free (ptr);
+}
+
+void *
+kms_malloc (size_t size)
+{
+   return installed.malloc (size, installed.ctx);
+}
+
+void *
+kms_calloc (size_t nmemb, size_t size)
+{
+   void *ptr;
+
+   if (size && nmemb > SIZE_MAX / size) {
+      return NULL;
+   }
+
+   ptr = kms_malloc (nmemb * size);
+   if (ptr) {
+      memset (ptr, 0, nmemb * size);
+   }
+
+   return ptr;
+}
+
+void *
+kms_realloc (void *ptr, size_t size)
+{
+   return installed.realloc (ptr, size, installed.ctx);
+}
+
+void
+kms_free (void *ptr)
+{
+   if (ptr) {
+      installed.free (ptr, installed.ctx);
+   }
+}
+
+char *
+kms_strdup (const char *str)
+{
+   return kms_strndup (str, strlen (str));
+}
+
+char *
+kms_strndup (const char *str, size_t len)
+{
+   const char *end = memchr (str, '\0', len);
+   char *copy;
+
+   if (end) {
+      len = (size_t) (end - str);
+   }
+
+   copy = kms_malloc (len + 1);
+   if (copy) {
+      memcpy (copy, str, len);
+      copy[len] = '\0';
+   }
+
+   return copy;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_ALLOC_H
+#define KMS_ALLOC_H
+
+#include "kms_message/kms_message_defines.h"
+
+#include <stddef.h>
+
+/* allocate with the allocator from kms_message_init_with_allocator, or the
+ * C library's. exported for the tests, which build some sources twice. */
+KMS_MSG_EXPORT (void *)
+kms_malloc (size_t size);
+/* zeroed */
+KMS_MSG_EXPORT (void *)
+kms_calloc (size_t nmemb, size_t size);
+KMS_MSG_EXPORT (void *)
+kms_realloc (void *ptr, size_t size);
+KMS_MSG_EXPORT (void)
+kms_free (void *ptr);
+KMS_MSG_EXPORT (char *)
+kms_strdup (const char *str);
+/* at most "len" bytes of "str", nul-terminated */
+KMS_MSG_EXPORT (char *)
+kms_strndup (const char *str, size_t len);
+
+#endif /* KMS_ALLOC_H */
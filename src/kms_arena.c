@@ -0,0 +1,224 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* enough for any type the library allocates */
+#define ALIGN 16
+#define ALIGN_UP(_n) (((_n) + ALIGN - 1) & ~(size_t) (ALIGN - 1))
+
+struct _kms_arena_chunk_t {
+   kms_arena_chunk_t *prev;
+   bool owned; /* false for the caller's block */
+   char *next;
+   char *end;
+};
+
+/* lay out a chunk at the start of "mem", its space after the header */
+static kms_arena_chunk_t *
+chunk_init (void *mem, size_t size, bool owned)
+{
+   kms_arena_chunk_t *chunk = mem;
+   uintptr_t start = (uintptr_t) mem + sizeof (kms_arena_chunk_t);
+
+   chunk->prev = NULL;
+   chunk->owned = owned;
+   chunk->next = (char *) ALIGN_UP (start);
+   chunk->end = (char *) mem + size;
+   if (chunk->next > chunk->end) {
+      chunk->next = chunk->end;
+   }
+
+   return chunk;
+}
+
+static kms_arena_chunk_t *
+chunk_new (size_t size)
+{
+   void *mem =
+      kms_malloc (ALIGN_UP (sizeof (kms_arena_chunk_t)) + ALIGN + size);
+
+   if (!mem) {
+      return NULL;
+   }
+
+   return chunk_init (
+      mem, ALIGN_UP (sizeof (kms_arena_chunk_t)) + ALIGN + size, true);
+}
+
+static void *
+chunk_alloc (kms_arena_chunk_t *chunk, size_t size)
+{
+   char *p = chunk->next;
+
+   if ((size_t) (chunk->end - p) < size) {
+      return NULL;
+   }
+
+   chunk->next = (char *) ALIGN_UP ((uintptr_t) (p + size));
+   if (chunk->next > chunk->end) {
+      chunk->next = chunk->end;
+   }
+
+   return p;
+}
+
+kms_arena_t *
+kms_arena_new (void *block, size_t block_size, size_t chunk_size)
+{
+   kms_arena_chunk_t *chunk = NULL;
+   kms_arena_t *arena;
+   size_t pad;
+
+   /* the chunk header goes at the start of the block, so align it */
+   if (block) {
+      pad = ALIGN_UP ((uintptr_t) block) - (uintptr_t) block;
+      block_size = block_size > pad ? block_size - pad : 0;
+      block = (char *) block + pad;
+   }
+
+   if (block && block_size >= ALIGN_UP (sizeof (kms_arena_chunk_t)) + ALIGN +
+                                 sizeof (kms_arena_t)) {
+      chunk = chunk_init (block, block_size, false);
+   } else {
+      chunk = chunk_new (chunk_size + sizeof (kms_arena_t));
+      if (!chunk) {
+         return NULL;
+      }
+   }
+
+   arena = chunk_alloc (chunk, sizeof (kms_arena_t));
+   arena->chunk = chunk;
+   arena->chunk_size = chunk_size;
+   arena->last = NULL;
+   arena->last_size = 0;
+
+   return arena;
+}
+
+void
+kms_arena_destroy (kms_arena_t *arena)
+{
+   kms_arena_chunk_t *chunk;
+   kms_arena_chunk_t *prev;
+
+   if (!arena) {
+      return;
+   }
+
+   /* the arena is in one of the chunks, don't touch it after the loop starts
+    * freeing them */
+   for (chunk = arena->chunk; chunk; chunk = prev) {
+      prev = chunk->prev;
+      if (chunk->owned) {
+         kms_free (chunk);
+      }
+   }
+}
+
+void *
+kms_arena_alloc (kms_arena_t *arena, size_t size)
+{
+   kms_arena_chunk_t *chunk;
+   void *p;
+
+   if (!arena) {
+      return kms_malloc (size);
+   }
+
+   p = chunk_alloc (arena->chunk, size);
+   if (!p) {
+      /* a big allocation gets a chunk of its own behind the current one, so
+       * the current one's space isn't abandoned */
+      if (size > arena->chunk_size / 4) {
+         chunk = chunk_new (size);
+         if (!chunk) {
+            return NULL;
+         }
+
+         chunk->prev = arena->chunk->prev;
+         arena->chunk->prev = chunk;
+         return chunk_alloc (chunk, size);
+      }
+
+      chunk = chunk_new (arena->chunk_size);
+      if (!chunk) {
+         return NULL;
+      }
+
+      chunk->prev = arena->chunk;
+      arena->chunk = chunk;
+      p = chunk_alloc (chunk, size);
+   }
+
+   arena->last = p;
+   arena->last_size = size;
+   return p;
+}
+
+void *
+kms_arena_realloc (kms_arena_t *arena,
+                   void *ptr,
+                   size_t old_size,
+                   size_t size)
+{
+   kms_arena_chunk_t *chunk;
+   void *p;
+
+   if (!arena) {
+      return kms_realloc (ptr, size);
+   }
+
+   if (!ptr) {
+      return kms_arena_alloc (arena, size);
+   }
+
+   if (size <= old_size) {
+      return ptr;
+   }
+
+   /* grow the most recent allocation where it is, if there's room */
+   chunk = arena->chunk;
+   if (ptr == arena->last && (size_t) (chunk->end - (char *) ptr) >= size) {
+      chunk->next = (char *) ALIGN_UP ((uintptr_t) ((char *) ptr + size));
+      if (chunk->next > chunk->end) {
+         chunk->next = chunk->end;
+      }
+
+      arena->last_size = size;
+      return ptr;
+   }
+
+   p = kms_arena_alloc (arena, size);
+   if (p) {
+      memcpy (p, ptr, old_size);
+   }
+
+   return p;
+}
+
+void
+kms_arena_free (kms_arena_t *arena, void *ptr)
+{
+   if (!arena) {
+      kms_free (ptr);
+   }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_ARENA_H
+#define KMS_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define KMS_ARENA_CHUNK_SIZE 4096
+
+/* a bump allocator whose allocations are all released at once by
+ * kms_arena_destroy. it starts in an optional block from the caller, then
+ * takes chunks from malloc. */
+typedef struct _kms_arena_chunk_t kms_arena_chunk_t;
+
+typedef struct {
+   /* the chunk allocations come from, the others are linked behind it */
+   kms_arena_chunk_t *chunk;
+   size_t chunk_size;
+   /* the most recent allocation, which can grow in place */
+   char *last;
+   size_t last_size;
+} kms_arena_t;
+
+/* "block" may be NULL, or have any alignment, the first bytes up to a
+ * 16-byte boundary are skipped. the arena lives in its own memory, so if
+ * "block" is big enough nothing is allocated until it's full. */
+kms_arena_t *
+kms_arena_new (void *block, size_t block_size, size_t chunk_size);
+void
+kms_arena_destroy (kms_arena_t *arena);
+/* the rest fall back to kms_malloc, kms_realloc, and kms_free when "arena"
+ * is NULL, so code can allocate the same way with or without an arena */
+void *
+kms_arena_alloc (kms_arena_t *arena, size_t size);
+/* "old_size" is the size "ptr" was allocated with */
+void *
+kms_arena_realloc (kms_arena_t *arena,
+                   void *ptr,
+                   size_t old_size,
+                   size_t size);
+/* a no-op with an arena */
+void
+kms_arena_free (kms_arena_t *arena, void *ptr);
+
+#endif /* KMS_ARENA_H */
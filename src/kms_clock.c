@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_clock.h"
+#include "kms_message/kms_message.h"
+
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__)
+#define KMS_THREAD_LOCAL __thread
+#endif
+
+#define DATETIME_LEN (sizeof "YYYYmmDDTHHMMSSZ" - 1)
+
+typedef struct {
+   bool valid;
+   int64_t second;
+   char datetime[DATETIME_LEN + 1];
+} clock_cache_t;
+
+static int64_t
+realtime_clock (void *ctx)
+{
+#ifdef CLOCK_REALTIME_COARSE
+   /* from the vDSO, a few nanoseconds, and a second is all we need */
+   struct timespec ts;
+
+   if (0 == clock_gettime (CLOCK_REALTIME_COARSE, &ts)) {
+      return (int64_t) ts.tv_sec;
+   }
+#endif
+
+   (void) ctx;
+   return (int64_t) time (NULL);
+}
+
+static kms_clock_t clock_fn = realtime_clock;
+static void *clock_ctx;
+
+void
+kms_message_set_clock (kms_clock_t clock, void *ctx)
+{
+   clock_fn = clock ? clock : realtime_clock;
+   clock_ctx = clock ? ctx : NULL;
+}
+
+int64_t
+kms_clock_now (void)
+{
+   return clock_fn (clock_ctx);
+}
+
+static void
+put_digits (char *out, int value, int n)
+{
+   while (n--) {
+      out[n] = (char) ('0' + value % 10);
+      value /= 10;
+   }
+}
+
+static bool
+format_datetime (int64_t second, char *out)
+{
+   time_t t = (time_t) second;
+   struct tm tm;
+
+   if (!gmtime_r (&t, &tm) || tm.tm_year < -1900 || tm.tm_year > 9999 - 1900) {
+      return false;
+   }
+
+   put_digits (out, tm.tm_year + 1900, 4);
+   put_digits (out + 4, tm.tm_mon + 1, 2);
+   put_digits (out + 6, tm.tm_mday, 2);
+   out[8] = 'T';
+   put_digits (out + 9, tm.tm_hour, 2);
+   put_digits (out + 11, tm.tm_min, 2);
+   put_digits (out + 13, tm.tm_sec, 2);
+   out[15] = 'Z';
+   out[16] = '\0';
+
+   return true;
+}
+
+bool
+kms_clock_format_now (char *out)
+{
+#ifdef KMS_THREAD_LOCAL
+   static KMS_THREAD_LOCAL clock_cache_t cache;
+#else
+   clock_cache_t cache = {0};
+#endif
+   int64_t second = kms_clock_now ();
+
+   if (!cache.valid || cache.second != second) {
+      cache.valid = format_datetime (second, cache.datetime);
+      cache.second = second;
+      if (!cache.valid) {
+         return false;
+      }
+   }
+
+   memcpy (out, cache.datetime, DATETIME_LEN + 1);
+   return true;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_CLOCK_H
+#define KMS_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* seconds since the epoch, from the clock set with kms_message_set_clock */
+int64_t
+kms_clock_now (void);
+
+/* the time now, like "20150830T123600Z", from the clock set with
+ * kms_message_set_clock. formatted once per second per thread. "out" has room
+ * for the terminating nul. */
+bool
+kms_clock_format_now (char *out);
+
+#endif /* KMS_CLOCK_H */
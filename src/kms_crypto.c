@@ -14,46 +14,262 @@
  * limitations under the License.
  */
 
+#include "kms_alloc.h"
 #include "kms_crypto.h"
 
-#include <openssl/sha.h>
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
+#include <string.h>
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L || \
-   (defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x20700000L)
-EVP_MD_CTX *
-EVP_MD_CTX_new (void)
+#ifdef KMS_MESSAGE_ENABLE_OPENSSL
+static const kms_crypto_t *crypto = &kms_crypto_openssl;
+#else
+static const kms_crypto_t *crypto = &kms_crypto_builtin;
+#endif
+
+bool
+kms_crypto_set_backend (kms_crypto_backend_t backend)
 {
-   return calloc (sizeof (EVP_MD_CTX), 1);
+   switch (backend) {
+   case KMS_CRYPTO_DEFAULT:
+#ifdef KMS_MESSAGE_ENABLE_OPENSSL
+      crypto = &kms_crypto_openssl;
+#else
+      crypto = &kms_crypto_builtin;
+#endif
+      return crypto->backend_init ();
+   case KMS_CRYPTO_OPENSSL:
+#ifdef KMS_MESSAGE_ENABLE_OPENSSL
+      crypto = &kms_crypto_openssl;
+      return crypto->backend_init ();
+#else
+      return false;
+#endif
+   case KMS_CRYPTO_BUILTIN:
+      crypto = &kms_crypto_builtin;
+      return crypto->backend_init ();
+   }
+
+   return false;
 }
 
 void
-EVP_MD_CTX_free (EVP_MD_CTX *ctx)
+kms_crypto_cleanup (void)
 {
-   EVP_MD_CTX_cleanup (ctx);
-   free (ctx);
-}
+   kms_crypto_builtin.backend_cleanup ();
+#ifdef KMS_MESSAGE_ENABLE_OPENSSL
+   kms_crypto_openssl.backend_cleanup ();
 #endif
+}
+
+const kms_crypto_t *
+kms_crypto_get (void)
+{
+   return crypto;
+}
 
 bool
 kms_sha256 (const char *input, size_t len, unsigned char *hash_out)
 {
-   EVP_MD_CTX *digest_ctxp = EVP_MD_CTX_new ();
-   bool rval = false;
+   kms_sha256_state_t state;
+
+   if (!crypto->sha256_init (&state)) {
+      return false;
+   }
+
+   if (!crypto->sha256_update (&state, input, len)) {
+      crypto->sha256_cleanup (&state);
+      return false;
+   }
+
+   return crypto->sha256_final (&state, hash_out);
+}
+
+struct _kms_sha256_ctx_t {
+   kms_sha256_state_t state;
+   kms_arena_t *arena;
+};
+
+kms_sha256_ctx_t *
+kms_sha256_ctx_new (void)
+{
+   return kms_sha256_ctx_new_in (NULL);
+}
+
+kms_sha256_ctx_t *
+kms_sha256_ctx_new_in (kms_arena_t *arena)
+{
+   kms_sha256_ctx_t *ctx = kms_arena_alloc (arena, sizeof (kms_sha256_ctx_t));
+
+   if (!ctx) {
+      return NULL;
+   }
+
+   ctx->arena = arena;
+   if (!crypto->sha256_init (&ctx->state)) {
+      kms_arena_free (arena, ctx);
+      return NULL;
+   }
+
+   return ctx;
+}
+
+void
+kms_sha256_ctx_destroy (kms_sha256_ctx_t *ctx)
+{
+   if (!ctx) {
+      return;
+   }
+
+   crypto->sha256_cleanup (&ctx->state);
+   kms_arena_free (ctx->arena, ctx);
+}
+
+kms_sha256_ctx_t *
+kms_sha256_ctx_reset (kms_sha256_ctx_t *ctx)
+{
+   crypto->sha256_cleanup (&ctx->state);
+   if (!crypto->sha256_init (&ctx->state)) {
+      kms_arena_free (ctx->arena, ctx);
+      return NULL;
+   }
+
+   return ctx;
+}
+
+bool
+kms_sha256_ctx_update (kms_sha256_ctx_t *ctx, const char *input, size_t len)
+{
+   return crypto->sha256_update (&ctx->state, input, len);
+}
+
+bool
+kms_sha256_ctx_digest (const kms_sha256_ctx_t *ctx, unsigned char *hash_out)
+{
+   kms_sha256_state_t copy;
+
+   return crypto->sha256_copy (&copy, &ctx->state) &&
+          crypto->sha256_final (&copy, hash_out);
+}
+
+static bool
+hmac_pad_init (kms_sha256_state_t *state,
+               const unsigned char *key,
+               size_t key_len,
+               unsigned char pad)
+{
+   unsigned char block[64];
+   size_t i;
+
+   for (i = 0; i < sizeof (block); i++) {
+      block[i] = (unsigned char) ((i < key_len ? key[i] : 0) ^ pad);
+   }
+
+   if (!crypto->sha256_init (state)) {
+      return false;
+   }
+
+   if (!crypto->sha256_update (state, block, sizeof (block))) {
+      crypto->sha256_cleanup (state);
+      return false;
+   }
+
+   return true;
+}
+
+bool
+kms_hmac_sha256_key_init (kms_hmac_sha256_key_t *hmac_key,
+                          const unsigned char *key,
+                          size_t key_len)
+{
+   unsigned char hashed_key[32];
+
+   hmac_key->initialized = false;
+
+   /* RFC 2104: keys longer than the block size are hashed first */
+   if (key_len > 64) {
+      if (!kms_sha256 ((const char *) key, key_len, hashed_key)) {
+         return false;
+      }
 
-   if (1 != EVP_DigestInit_ex (digest_ctxp, EVP_sha256 (), NULL)) {
-      goto cleanup;
+      key = hashed_key;
+      key_len = sizeof (hashed_key);
    }
 
-   if (1 != EVP_DigestUpdate (digest_ctxp, input, len)) {
-      goto cleanup;
+   if (!hmac_pad_init (&hmac_key->inner, key, key_len, 0x36)) {
+      return false;
    }
 
-   rval = (1 == EVP_DigestFinal_ex (digest_ctxp, hash_out, NULL));
+   if (!hmac_pad_init (&hmac_key->outer, key, key_len, 0x5c)) {
+      crypto->sha256_cleanup (&hmac_key->inner);
+      return false;
+   }
+
+   hmac_key->initialized = true;
+   return true;
+}
+
+void
+kms_hmac_sha256_key_cleanup (kms_hmac_sha256_key_t *hmac_key)
+{
+   if (!hmac_key->initialized) {
+      return;
+   }
+
+   crypto->sha256_cleanup (&hmac_key->inner);
+   crypto->sha256_cleanup (&hmac_key->outer);
+   hmac_key->initialized = false;
+}
+
+bool
+kms_hmac_sha256_keyed (const kms_hmac_sha256_key_t *hmac_key,
+                       const char *input,
+                       size_t len,
+                       unsigned char *hash_out)
+{
+   kms_sha256_state_t state;
+   unsigned char inner_hash[32];
+
+   if (!crypto->sha256_copy (&state, &hmac_key->inner)) {
+      return false;
+   }
+
+   if (!crypto->sha256_update (&state, input, len)) {
+      crypto->sha256_cleanup (&state);
+      return false;
+   }
+
+   if (!crypto->sha256_final (&state, inner_hash)) {
+      return false;
+   }
+
+   if (!crypto->sha256_copy (&state, &hmac_key->outer)) {
+      return false;
+   }
+
+   if (!crypto->sha256_update (&state, inner_hash, sizeof (inner_hash))) {
+      crypto->sha256_cleanup (&state);
+      return false;
+   }
+
+   return crypto->sha256_final (&state, hash_out);
+}
+
+bool
+kms_sha256_hmac (const char *key_input,
+                 size_t key_len,
+                 const char *input,
+                 size_t len,
+                 unsigned char *hash_out)
+{
+   kms_hmac_sha256_key_t hmac_key;
+   bool rval;
+
+   if (!kms_hmac_sha256_key_init (
+          &hmac_key, (const unsigned char *) key_input, key_len)) {
+      return false;
+   }
 
-cleanup:
-   EVP_MD_CTX_free (digest_ctxp);
+   rval = kms_hmac_sha256_keyed (&hmac_key, input, len, hash_out);
+   kms_hmac_sha256_key_cleanup (&hmac_key);
 
    return rval;
 }
@@ -17,10 +17,96 @@
 #ifndef KMS_MESSAGE_KMS_CRYPTO_H
 #define KMS_MESSAGE_KMS_CRYPTO_H
 
+#include "kms_arena.h"
+#include "kms_message/kms_message_defines.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+/* storage for a backend's SHA-256 state */
+typedef union {
+   uint64_t align;
+   unsigned char bytes[128];
+} kms_sha256_state_t;
+
+/* a SHA-256 implementation. "final" and "cleanup" release whatever "init" and
+ * "copy" acquired, "copy" initializes "dst". "backend_init" runs when the
+ * backend is selected and "backend_cleanup" from kms_message_cleanup, both
+ * may run more than once. */
+typedef struct {
+   const char *name;
+   bool (*backend_init) (void);
+   void (*backend_cleanup) (void);
+   bool (*sha256_init) (kms_sha256_state_t *state);
+   bool (*sha256_update) (kms_sha256_state_t *state,
+                          const void *input,
+                          size_t len);
+   bool (*sha256_final) (kms_sha256_state_t *state, unsigned char *hash_out);
+   bool (*sha256_copy) (kms_sha256_state_t *dst,
+                        const kms_sha256_state_t *src);
+   void (*sha256_cleanup) (kms_sha256_state_t *state);
+} kms_crypto_t;
+
+extern const kms_crypto_t kms_crypto_builtin;
+#ifdef KMS_MESSAGE_ENABLE_OPENSSL
+extern const kms_crypto_t kms_crypto_openssl;
+#endif
+
+/* objects created with one backend must be destroyed before switching */
+bool
+kms_crypto_set_backend (kms_crypto_backend_t backend);
+const kms_crypto_t *
+kms_crypto_get (void);
+/* releases what the backends hold, call after other threads are done */
+void
+kms_crypto_cleanup (void);
+
+/* an HMAC-SHA256 key after the key schedule: the SHA-256 states that have
+ * absorbed the key padded with ipad and opad. signing with it costs only the
+ * compressions of the message and the outer block. */
+typedef struct {
+   bool initialized;
+   kms_sha256_state_t inner;
+   kms_sha256_state_t outer;
+} kms_hmac_sha256_key_t;
+
+/* a running SHA-256 */
+typedef struct _kms_sha256_ctx_t kms_sha256_ctx_t;
+
 bool
 kms_sha256 (const char *input, size_t len, unsigned char *hash_out);
+kms_sha256_ctx_t *
+kms_sha256_ctx_new (void);
+/* in "arena" if it's not NULL */
+kms_sha256_ctx_t *
+kms_sha256_ctx_new_in (kms_arena_t *arena);
+void
+kms_sha256_ctx_destroy (kms_sha256_ctx_t *ctx);
+/* start a new hash in "ctx". on failure "ctx" is freed and NULL returned */
+kms_sha256_ctx_t *
+kms_sha256_ctx_reset (kms_sha256_ctx_t *ctx);
+bool
+kms_sha256_ctx_update (kms_sha256_ctx_t *ctx, const char *input, size_t len);
+/* the hash of the input so far, "ctx" can still be updated afterward */
+bool
+kms_sha256_ctx_digest (const kms_sha256_ctx_t *ctx, unsigned char *hash_out);
+bool
+kms_sha256_hmac (const char *key_input,
+                 size_t key_len,
+                 const char *input,
+                 size_t len,
+                 unsigned char *hash_out);
+bool
+kms_hmac_sha256_key_init (kms_hmac_sha256_key_t *hmac_key,
+                          const unsigned char *key,
+                          size_t key_len);
+void
+kms_hmac_sha256_key_cleanup (kms_hmac_sha256_key_t *hmac_key);
+bool
+kms_hmac_sha256_keyed (const kms_hmac_sha256_key_t *hmac_key,
+                       const char *input,
+                       size_t len,
+                       unsigned char *hash_out);
 
 #endif /* KMS_MESSAGE_KMS_CRYPTO_H */
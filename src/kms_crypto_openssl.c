@@ -0,0 +1,335 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_crypto.h"
+
+#include <openssl/evp.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L || \
+   (defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x20700000L)
+EVP_MD_CTX *
+EVP_MD_CTX_new (void)
+{
+   return kms_calloc (sizeof (EVP_MD_CTX), 1);
+}
+
+void
+EVP_MD_CTX_free (EVP_MD_CTX *ctx)
+{
+   EVP_MD_CTX_cleanup (ctx);
+   kms_free (ctx);
+}
+#endif
+
+/* OpenSSL 3 looks up the provider's implementation on each EVP_DigestInit_ex
+ * with EVP_sha256 (), under a lock. Fetch it once instead. */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define KMS_OPENSSL_FETCH
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef KMS_OPENSSL_FETCH
+static EVP_MD *fetched_sha256 = NULL;
+#endif
+
+static const EVP_MD *
+sha256_md (void)
+{
+#ifdef KMS_OPENSSL_FETCH
+   if (fetched_sha256) {
+      return fetched_sha256;
+   }
+#endif
+   return EVP_sha256 ();
+}
+
+/* each thread keeps a few EVP_MD_CTX for reuse, so hashing doesn't allocate
+ * and free one every time */
+#define CTX_CACHE_SIZE 4
+
+typedef struct _ctx_cache_t {
+   int n;
+   EVP_MD_CTX *ctxs[CTX_CACHE_SIZE];
+   struct _ctx_cache_t *next; /* in "caches", without FLS */
+} ctx_cache_t;
+
+static void
+ctx_cache_destroy (void *p)
+{
+   ctx_cache_t *cache = p;
+
+   if (!cache) {
+      return;
+   }
+
+   while (cache->n > 0) {
+      EVP_MD_CTX_free (cache->ctxs[--cache->n]);
+   }
+
+   kms_free (cache);
+}
+
+#ifdef _WIN32
+
+static DWORD cache_key = FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI
+ctx_cache_destructor (PVOID p)
+{
+   ctx_cache_destroy (p);
+}
+
+static bool
+cache_key_create (void)
+{
+   if (cache_key == FLS_OUT_OF_INDEXES) {
+      cache_key = FlsAlloc (ctx_cache_destructor);
+   }
+
+   return cache_key != FLS_OUT_OF_INDEXES;
+}
+
+static void
+cache_key_delete (void)
+{
+   if (cache_key != FLS_OUT_OF_INDEXES) {
+      /* runs the destructor for this thread's cache */
+      FlsFree (cache_key);
+      cache_key = FLS_OUT_OF_INDEXES;
+   }
+}
+
+#define CACHE_KEY_VALID (cache_key != FLS_OUT_OF_INDEXES)
+#define CACHE_GET() ((ctx_cache_t *) FlsGetValue (cache_key))
+#define CACHE_SET(_cache) ((void) FlsSetValue (cache_key, (_cache)))
+
+#else
+
+static pthread_key_t cache_key;
+static bool cache_key_valid = false;
+/* unlike FlsFree, pthread_key_delete doesn't run the destructor for other
+ * threads, so keep every thread's cache where cleanup can free it */
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ctx_cache_t *caches = NULL;
+
+static void
+ctx_cache_thread_exit (void *p)
+{
+   ctx_cache_t **cache;
+
+   pthread_mutex_lock (&caches_mutex);
+   /* cleanup may have freed it already */
+   cache = &caches;
+   while (*cache && *cache != p) {
+      cache = &(*cache)->next;
+   }
+
+   if (*cache) {
+      *cache = (*cache)->next;
+      ctx_cache_destroy (p);
+   }
+
+   pthread_mutex_unlock (&caches_mutex);
+}
+
+static bool
+cache_key_create (void)
+{
+   if (!cache_key_valid) {
+      cache_key_valid =
+         0 == pthread_key_create (&cache_key, ctx_cache_thread_exit);
+   }
+
+   return cache_key_valid;
+}
+
+static void
+cache_key_delete (void)
+{
+   ctx_cache_t *cache;
+
+   pthread_mutex_lock (&caches_mutex);
+   if (cache_key_valid) {
+      while (caches) {
+         cache = caches;
+         caches = cache->next;
+         ctx_cache_destroy (cache);
+      }
+
+      pthread_key_delete (cache_key);
+      cache_key_valid = false;
+   }
+
+   pthread_mutex_unlock (&caches_mutex);
+}
+
+static void
+cache_set (ctx_cache_t *cache)
+{
+   pthread_mutex_lock (&caches_mutex);
+   cache->next = caches;
+   caches = cache;
+   pthread_mutex_unlock (&caches_mutex);
+   (void) pthread_setspecific (cache_key, cache);
+}
+
+#define CACHE_KEY_VALID (cache_key_valid)
+#define CACHE_GET() ((ctx_cache_t *) pthread_getspecific (cache_key))
+#define CACHE_SET(_cache) cache_set (_cache)
+
+#endif /* _WIN32 */
+
+static EVP_MD_CTX *
+ctx_acquire (void)
+{
+   ctx_cache_t *cache;
+
+   if (CACHE_KEY_VALID) {
+      cache = CACHE_GET ();
+      if (cache && cache->n > 0) {
+         return cache->ctxs[--cache->n];
+      }
+   }
+
+   return EVP_MD_CTX_new ();
+}
+
+static void
+ctx_release (EVP_MD_CTX *ctx)
+{
+   ctx_cache_t *cache;
+
+   if (!ctx) {
+      return;
+   }
+
+   if (CACHE_KEY_VALID) {
+      cache = CACHE_GET ();
+      if (!cache) {
+         cache = kms_calloc (1, sizeof (ctx_cache_t));
+         if (cache) {
+            CACHE_SET (cache);
+         }
+      }
+
+      if (cache && cache->n < CTX_CACHE_SIZE) {
+         cache->ctxs[cache->n++] = ctx;
+         return;
+      }
+   }
+
+   EVP_MD_CTX_free (ctx);
+}
+
+static bool
+openssl_backend_init (void)
+{
+#ifdef KMS_OPENSSL_FETCH
+   if (!fetched_sha256) {
+      fetched_sha256 = EVP_MD_fetch (NULL, "SHA256", NULL);
+      if (!fetched_sha256) {
+         return false;
+      }
+   }
+#endif
+
+   return cache_key_create ();
+}
+
+static void
+openssl_backend_cleanup (void)
+{
+   cache_key_delete ();
+#ifdef KMS_OPENSSL_FETCH
+   EVP_MD_free (fetched_sha256);
+   fetched_sha256 = NULL;
+#endif
+}
+
+/* the state holds a pointer to an EVP_MD_CTX */
+#define MD_CTX(_state) (*(EVP_MD_CTX **) (_state)->bytes)
+
+static bool
+openssl_sha256_init (kms_sha256_state_t *state)
+{
+   MD_CTX (state) = ctx_acquire ();
+   if (!MD_CTX (state)) {
+      return false;
+   }
+
+   if (1 != EVP_DigestInit_ex (MD_CTX (state), sha256_md (), NULL)) {
+      EVP_MD_CTX_free (MD_CTX (state));
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+openssl_sha256_update (kms_sha256_state_t *state,
+                       const void *input,
+                       size_t len)
+{
+   return 1 == EVP_DigestUpdate (MD_CTX (state), input, len);
+}
+
+static bool
+openssl_sha256_final (kms_sha256_state_t *state, unsigned char *hash_out)
+{
+   bool rval = (1 == EVP_DigestFinal_ex (MD_CTX (state), hash_out, NULL));
+
+   ctx_release (MD_CTX (state));
+   return rval;
+}
+
+static bool
+openssl_sha256_copy (kms_sha256_state_t *dst, const kms_sha256_state_t *src)
+{
+   MD_CTX (dst) = ctx_acquire ();
+   if (!MD_CTX (dst)) {
+      return false;
+   }
+
+   if (1 != EVP_MD_CTX_copy_ex (MD_CTX (dst), MD_CTX (src))) {
+      EVP_MD_CTX_free (MD_CTX (dst));
+      return false;
+   }
+
+   return true;
+}
+
+static void
+openssl_sha256_cleanup (kms_sha256_state_t *state)
+{
+   ctx_release (MD_CTX (state));
+}
+
+const kms_crypto_t kms_crypto_openssl = {
+   "openssl",
+   openssl_backend_init,
+   openssl_backend_cleanup,
+   openssl_sha256_init,
+   openssl_sha256_update,
+   openssl_sha256_final,
+   openssl_sha256_copy,
+   openssl_sha256_cleanup,
+};
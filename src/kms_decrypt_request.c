@@ -17,53 +17,70 @@
 
 #include "kms_message/kms_message.h"
 #include "kms_message_private.h"
-#include "b64.h"
 #include "kms_request_str.h"
 
-
-kms_request_t *
-kms_decrypt_request_new (const uint8_t *ciphertext_blob,
-                         size_t len,
-                         const kms_request_opt_t *opt)
+/* like {"CiphertextBlob": "<base64>"} */
+static void
+append_ciphertext_blob (kms_request_t *request,
+                        const uint8_t *ciphertext_blob,
+                        size_t len)
 {
-   kms_request_t *request;
-   size_t b64_len;
-   char *b64 = NULL;
-   kms_request_str_t *payload = NULL;
+   kms_request_append_payload (
+      request, "{\"CiphertextBlob\": \"", sizeof "{\"CiphertextBlob\": \"" - 1);
+   kms_request_append_payload_b64 (request, ciphertext_blob, len);
+   kms_request_append_payload (request, "\"}", 2);
+}
 
-   request = kms_request_new ("POST", "/", opt);
+static void
+init_decrypt_request (kms_request_t *request,
+                      const uint8_t *ciphertext_blob,
+                      size_t len)
+{
    if (kms_request_get_error (request)) {
-      goto done;
+      return;
    }
 
    if (!(kms_request_add_header_field (
             request, "Content-Type", "application/x-amz-json-1.1") &&
          kms_request_add_header_field (
             request, "X-Amz-Target", "TrentService.Decrypt"))) {
-      goto done;
+      return;
    }
 
-   b64_len = (len / 3 + 1) * 4 + 1;
+   append_ciphertext_blob (request, ciphertext_blob, len);
+}
 
-   if (!(b64 = malloc (b64_len))) {
-      KMS_ERROR (request,
-                 "Could not allocate %d bytes for base64-encoding payload",
-                 b64_len);
-      goto done;
-   }
+kms_request_t *
+kms_decrypt_request_new (const uint8_t *ciphertext_blob,
+                         size_t len,
+                         const kms_request_opt_t *opt)
+{
+   kms_request_t *request = kms_request_new ("POST", "/", opt);
 
-   if (kms_message_b64_ntop (ciphertext_blob, len, b64, b64_len) == -1) {
-      KMS_ERROR (request, "Could not base64-encode ciphertext blob");
-      goto done;
-   }
+   init_decrypt_request (request, ciphertext_blob, len);
+   return request;
+}
 
-   payload = kms_request_str_new ();
-   kms_request_str_appendf (payload, "{\"CiphertextBlob\": \"%s\"}", b64);
-   kms_request_append_payload (request, payload->str, payload->len);
+bool
+kms_decrypt_request_reset (kms_request_t *request,
+                           const uint8_t *ciphertext_blob,
+                           size_t len,
+                           const kms_request_opt_t *opt)
+{
+   kms_request_reset (request, "POST", "/", opt);
+   init_decrypt_request (request, ciphertext_blob, len);
+   return !kms_request_get_error (request);
+}
 
-done:
-   free (b64);
-   kms_request_str_destroy (payload);
+kms_request_t *
+kms_decrypt_request_new_from_proto (const kms_request_proto_t *proto,
+                                    const uint8_t *ciphertext_blob,
+                                    size_t len)
+{
+   kms_request_t *request = kms_request_new_from_proto_sized (
+      proto,
+      sizeof "{\"CiphertextBlob\": \"\"}" - 1 + (len + 2) / 3 * 4);
 
+   append_ciphertext_blob (request, ciphertext_blob, len);
    return request;
 }
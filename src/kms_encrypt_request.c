@@ -17,7 +17,6 @@
 
 #include "kms_message/kms_message.h"
 #include "kms_message_private.h"
-#include "b64.h"
 #include "kms_request_str.h"
 
 kms_request_t *
@@ -25,47 +24,30 @@ kms_encrypt_request_new (const char *plaintext,
                          const char *key_id,
                          const kms_request_opt_t *opt)
 {
-   size_t plain_len;
    kms_request_t *request;
-   size_t b64_len;
-   char *b64 = NULL;
-   kms_request_str_t *payload = NULL;
 
    request = kms_request_new ("POST", "/", opt);
    if (kms_request_get_error (request)) {
-      goto done;
+      return request;
    }
 
    if (!(kms_request_add_header_field (
             request, "Content-Type", "application/x-amz-json-1.1") &&
          kms_request_add_header_field (
             request, "X-Amz-Target", "TrentService.Encrypt"))) {
-      goto done;
+      return request;
    }
 
-   plain_len = strlen (plaintext);
-   b64_len = (plain_len / 3 + 1) * 4 + 1;
-   if (!(b64 = malloc (b64_len))) {
-      KMS_ERROR (request,
-                 "Could not allocate %d bytes for base64-encoding payload",
-                 b64_len);
-      goto done;
-   }
-
-   if (kms_message_b64_ntop (
-          (const uint8_t *) plaintext, plain_len, b64, b64_len) == -1) {
-      KMS_ERROR (request, "Could not base64-encode plaintext");
-      goto done;
-   }
-
-   payload = kms_request_str_new ();
-   kms_request_str_appendf (
-      payload, "{\"Plaintext\": \"%s\", \"KeyId\": \"%s\"}", b64, key_id);
-   kms_request_append_payload (request, payload->str, payload->len);
-
-done:
-   free (b64);
-   kms_request_str_destroy (payload);
+   /* like {"Plaintext": "<base64>", "KeyId": "<key_id>"}, encoded straight
+    * into the payload instead of through temporary buffers */
+   kms_request_append_payload (
+      request, "{\"Plaintext\": \"", sizeof "{\"Plaintext\": \"" - 1);
+   kms_request_append_payload_b64 (
+      request, (const uint8_t *) plaintext, strlen (plaintext));
+   kms_request_append_payload (
+      request, "\", \"KeyId\": \"", sizeof "\", \"KeyId\": \"" - 1);
+   kms_request_append_payload (request, key_id, strlen (key_id));
+   kms_request_append_payload (request, "\"}", 2);
 
    return request;
 }
@@ -0,0 +1,495 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_header_list.h"
+#include "kms_message/kms_message.h"
+#include "kms_request_str.h"
+
+#include <ctype.h>
+
+/* a kms_request_str_t of a string literal, read-only */
+#define STATIC_STR(_s)                                  \
+   {                                                    \
+      (char *) (_s), sizeof (_s) - 1, sizeof (_s), NULL, \
+      {                                                 \
+         0                                              \
+      }                                                 \
+   }
+
+#define KNOWN(_name, _lower)                  \
+   {                                          \
+      STATIC_STR (_name), STATIC_STR (_lower) \
+   }
+
+/* indexed by kms_header_id_t */
+static struct {
+   kms_request_str_t name;
+   kms_request_str_t lower;
+} known[] = {
+   KNOWN ("", ""),
+   KNOWN ("Connection", "connection"),
+   KNOWN ("Content-Encoding", "content-encoding"),
+   KNOWN ("Content-Length", "content-length"),
+   KNOWN ("Content-Type", "content-type"),
+   KNOWN ("Host", "host"),
+   KNOWN ("X-Amz-Content-Sha256", "x-amz-content-sha256"),
+   KNOWN ("X-Amz-Date", "x-amz-date"),
+   KNOWN ("X-Amz-Decoded-Content-Length", "x-amz-decoded-content-length"),
+   KNOWN ("X-Amz-Target", "x-amz-target"),
+};
+
+#undef KNOWN
+#undef STATIC_STR
+
+kms_header_id_t
+kms_header_id (const char *key, size_t len)
+{
+   size_t i;
+
+   for (i = 1; i < sizeof (known) / sizeof (known[0]); i++) {
+      if (known[i].lower.len == len &&
+          0 == strncasecmp (known[i].lower.str, key, len)) {
+         return (kms_header_id_t) i;
+      }
+   }
+
+   return KMS_HEADER_UNKNOWN;
+}
+
+int
+kms_header_cmp (const kms_header_t *a, const kms_header_t *b)
+{
+   /* the ids are in the same order as the names */
+   if (a->id && b->id) {
+      return (int) a->id - (int) b->id;
+   }
+
+   return strcmp (a->lower_key->str, b->lower_key->str);
+}
+
+/* a key to look up, resolved to its id once */
+typedef struct {
+   const char *str;
+   size_t len;
+   kms_header_id_t id;
+} probe_t;
+
+static void
+probe_init (probe_t *probe, const char *key, size_t len)
+{
+   probe->str = key;
+   probe->len = len;
+   probe->id = kms_header_id (key, len);
+}
+
+/* like strcasecmp of the header's key and the probe's */
+static int
+cmp_key (const kms_header_t *header, const probe_t *probe)
+{
+   int cmp;
+
+   if (header->id && probe->id) {
+      return (int) header->id - (int) probe->id;
+   }
+
+   cmp = strncasecmp (header->lower_key->str, probe->str, probe->len);
+   if (cmp == 0 && header->lower_key->len > probe->len) {
+      return 1;
+   }
+
+   return cmp;
+}
+
+static bool
+has_upper (const char *str, size_t len)
+{
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      if (isupper ((unsigned char) str[i])) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/* whether kms_request_str_append_stripped would copy it unchanged */
+static bool
+is_stripped (const kms_request_str_t *str)
+{
+   const unsigned char *s = (const unsigned char *) str->str;
+   size_t i;
+
+   if (str->len == 0) {
+      return true;
+   }
+
+   if (isspace (s[0]) || isspace (s[str->len - 1])) {
+      return false;
+   }
+
+   for (i = 0; i < str->len; i++) {
+      if (isspace (s[i]) && (s[i] != ' ' || isspace (s[i + 1]))) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static void
+header_init (kms_header_t *header, kms_arena_t *arena)
+{
+   header->value = kms_request_str_new_in (arena);
+   header->own_key = NULL;
+   header->own_lower_key = NULL;
+   header->own_stripped_value = NULL;
+}
+
+/* after the value changes */
+static void
+header_strip (kms_header_t *header, kms_arena_t *arena)
+{
+   if (is_stripped (header->value)) {
+      header->stripped_value = header->value;
+      return;
+   }
+
+   if (!header->own_stripped_value) {
+      header->own_stripped_value = kms_request_str_new_in (arena);
+   }
+
+   kms_request_str_set_chars (header->own_stripped_value, "", 0);
+   kms_request_str_append_stripped (header->own_stripped_value, header->value);
+   header->stripped_value = header->own_stripped_value;
+}
+
+/* reuses the header's strings. a well-known key spelled the usual way shares
+ * the static name, otherwise it's copied; a well-known key's lowercase name
+ * is always shared, and so is a key that's lowercase already. */
+static void
+header_set (kms_header_t *header,
+            kms_arena_t *arena,
+            const probe_t *probe,
+            const char *value,
+            size_t value_len)
+{
+   kms_header_id_t id = probe->id;
+
+   header->id = id;
+   if (id && 0 == memcmp (known[id].name.str, probe->str, probe->len)) {
+      header->key = &known[id].name;
+   } else {
+      if (!header->own_key) {
+         header->own_key = kms_request_str_new_in (arena);
+      }
+
+      kms_request_str_set_chars (
+         header->own_key, probe->str, (ssize_t) probe->len);
+      header->key = header->own_key;
+   }
+
+   if (id) {
+      header->lower_key = &known[id].lower;
+   } else if (!has_upper (probe->str, probe->len)) {
+      header->lower_key = header->key;
+   } else {
+      if (!header->own_lower_key) {
+         header->own_lower_key = kms_request_str_new_in (arena);
+      }
+
+      kms_request_str_set_chars (header->own_lower_key, "", 0);
+      kms_request_str_append_lowercase (header->own_lower_key, header->key);
+      header->lower_key = header->own_lower_key;
+   }
+
+   kms_request_str_set_chars (header->value, value, (ssize_t) value_len);
+   header_strip (header, arena);
+}
+
+static void
+header_cleanup (kms_header_t *header)
+{
+   kms_request_str_destroy (header->own_key);
+   kms_request_str_destroy (header->value);
+   kms_request_str_destroy (header->own_lower_key);
+   kms_request_str_destroy (header->own_stripped_value);
+}
+
+kms_header_list_t *
+kms_header_list_new (void)
+{
+   return kms_header_list_new_in (NULL);
+}
+
+kms_header_list_t *
+kms_header_list_new_in (kms_arena_t *arena)
+{
+   kms_header_list_t *lst = kms_arena_alloc (arena, sizeof (kms_header_list_t));
+
+   lst->arena = arena;
+   lst->size = 16;
+   lst->headers = kms_arena_alloc (arena, lst->size * sizeof (kms_header_t));
+   lst->len = 0;
+   lst->allocated = 0;
+   lst->last = 0;
+
+   return lst;
+}
+
+void
+kms_header_list_destroy (kms_header_list_t *lst)
+{
+   size_t i;
+
+   if (!lst) {
+      return;
+   }
+
+   for (i = 0; i < lst->allocated; i++) {
+      header_cleanup (&lst->headers[i]);
+   }
+
+   kms_arena_free (lst->arena, lst->headers);
+   kms_arena_free (lst->arena, lst);
+}
+
+void
+kms_header_list_clear (kms_header_list_t *lst)
+{
+   lst->len = 0;
+   lst->last = 0;
+}
+
+kms_header_list_t *
+kms_header_list_dup (const kms_header_list_t *lst)
+{
+   kms_header_list_t *dup = kms_header_list_new ();
+   size_t i;
+
+   /* already sorted, so each is added at the end */
+   for (i = 0; i < lst->len; i++) {
+      kms_header_list_add_chars (dup,
+                                 lst->headers[i].key->str,
+                                 lst->headers[i].key->len,
+                                 lst->headers[i].value->str,
+                                 lst->headers[i].value->len);
+   }
+
+   dup->last = lst->last;
+   return dup;
+}
+
+/* the index of the first header whose key is greater than the probe's, or
+ * with "or_equal", greater or equal */
+static size_t
+bound (const kms_header_list_t *lst, const probe_t *probe, bool or_equal)
+{
+   size_t lo = 0;
+   size_t hi = lst->len;
+   size_t mid;
+   int cmp;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      /* lower_key is lowercase, so this is the same order as strcmp of two
+       * lowercase keys */
+      cmp = cmp_key (&lst->headers[mid], probe);
+      if (cmp < 0 || (cmp == 0 && !or_equal)) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return lo;
+}
+
+void
+kms_header_list_add (kms_header_list_t *lst,
+                     const char *key,
+                     const char *value)
+{
+   kms_header_list_add_chars (lst, key, strlen (key), value, strlen (value));
+}
+
+void
+kms_header_list_add_chars (kms_header_list_t *lst,
+                           const char *key,
+                           size_t key_len,
+                           const char *value,
+                           size_t value_len)
+{
+   probe_t probe;
+   kms_header_t header;
+   size_t i;
+
+   probe_init (&probe, key, key_len);
+
+   if (lst->len == lst->size) {
+      lst->headers =
+         kms_arena_realloc (lst->arena,
+                            lst->headers,
+                            lst->size * sizeof (kms_header_t),
+                            2 * lst->size * sizeof (kms_header_t));
+      lst->size *= 2;
+   }
+
+   /* reuse the strings of a header that was cleared or deleted */
+   if (lst->len < lst->allocated) {
+      header = lst->headers[lst->len];
+   } else {
+      header_init (&header, lst->arena);
+      lst->allocated++;
+   }
+
+   /* after any headers with the same key */
+   i = bound (lst, &probe, false);
+   memmove (&lst->headers[i + 1],
+            &lst->headers[i],
+            sizeof (kms_header_t) * (lst->len - i));
+   header_set (&header, lst->arena, &probe, value, value_len);
+   lst->headers[i] = header;
+   lst->len++;
+   lst->last = i;
+}
+
+bool
+kms_header_list_append_value (kms_header_list_t *lst,
+                              const char *value,
+                              size_t len)
+{
+   kms_header_t *header;
+
+   if (lst->len == 0) {
+      return false;
+   }
+
+   header = &lst->headers[lst->last];
+   kms_request_str_append_chars (header->value, value, (ssize_t) len);
+   header_strip (header, lst->arena);
+   return true;
+}
+
+const kms_header_t *
+kms_header_list_find (const kms_header_list_t *lst, const char *key)
+{
+   probe_t probe;
+   size_t i;
+
+   probe_init (&probe, key, strlen (key));
+   i = bound (lst, &probe, true);
+   if (i < lst->len && 0 == cmp_key (&lst->headers[i], &probe)) {
+      return &lst->headers[i];
+   }
+
+   return NULL;
+}
+
+bool
+kms_header_list_replace_value (kms_header_list_t *lst,
+                               const char *key,
+                               const char *value)
+{
+   probe_t probe;
+   kms_header_t *header;
+   size_t i;
+
+   probe_init (&probe, key, strlen (key));
+   i = bound (lst, &probe, true);
+   if (i == lst->len || bound (lst, &probe, false) != i + 1) {
+      return false;
+   }
+
+   header = &lst->headers[i];
+   kms_request_str_set_chars (header->value, value, -1);
+   header_strip (header, lst->arena);
+   lst->last = i;
+
+   return true;
+}
+
+void
+kms_header_list_del (kms_header_list_t *lst, const char *key)
+{
+   probe_t probe;
+   size_t start;
+   size_t end;
+   kms_header_t removed;
+   size_t i;
+
+   probe_init (&probe, key, strlen (key));
+   start = bound (lst, &probe, true);
+   end = bound (lst, &probe, false);
+   if (start == end) {
+      return;
+   }
+
+   /* move them past the last header, keeping their strings for reuse */
+   for (i = start; i < end; i++) {
+      removed = lst->headers[start];
+      memmove (&lst->headers[start],
+               &lst->headers[start + 1],
+               sizeof (kms_header_t) * (lst->len - start - 1));
+      lst->headers[--lst->len] = removed;
+   }
+
+   if (lst->last >= end) {
+      lst->last -= end - start;
+   } else if (lst->last >= start) {
+      /* the header added last is gone, nothing to append to */
+      lst->last = lst->len ? lst->len - 1 : 0;
+   }
+}
+
+void
+kms_header_iter_init (kms_header_iter_t *iter,
+                      const kms_header_list_t *first,
+                      const kms_header_list_t *second)
+{
+   iter->lists[0] = first;
+   iter->lists[1] = second;
+   iter->pos[0] = 0;
+   iter->pos[1] = 0;
+}
+
+const kms_header_t *
+kms_header_iter_next (kms_header_iter_t *iter)
+{
+   const kms_header_t *a = NULL;
+   const kms_header_t *b = NULL;
+
+   if (iter->lists[0] && iter->pos[0] < iter->lists[0]->len) {
+      a = &iter->lists[0]->headers[iter->pos[0]];
+   }
+
+   if (iter->lists[1] && iter->pos[1] < iter->lists[1]->len) {
+      b = &iter->lists[1]->headers[iter->pos[1]];
+   }
+
+   /* on a tie, "first" was added first */
+   if (a && (!b || kms_header_cmp (a, b) <= 0)) {
+      iter->pos[0]++;
+      return a;
+   }
+
+   if (b) {
+      iter->pos[1]++;
+   }
+
+   return b;
+}
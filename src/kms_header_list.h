@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_HEADER_LIST_H
+#define KMS_HEADER_LIST_H
+
+#include "kms_message/kms_message.h"
+#include "kms_request_str.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* headers the library adds itself, in the order of their lowercase names */
+typedef enum {
+   KMS_HEADER_UNKNOWN = 0,
+   KMS_HEADER_CONNECTION,
+   KMS_HEADER_CONTENT_ENCODING,
+   KMS_HEADER_CONTENT_LENGTH,
+   KMS_HEADER_CONTENT_TYPE,
+   KMS_HEADER_HOST,
+   KMS_HEADER_X_AMZ_CONTENT_SHA256,
+   KMS_HEADER_X_AMZ_DATE,
+   KMS_HEADER_X_AMZ_DECODED_CONTENT_LENGTH,
+   KMS_HEADER_X_AMZ_TARGET
+} kms_header_id_t;
+
+typedef struct {
+   kms_header_id_t id;
+   /* for a well-known header, shared static strings: never modify them */
+   kms_request_str_t *key;
+   kms_request_str_t *value;
+   /* for the canonical request: the key lowercased, the value with leading
+    * and repeated whitespace collapsed. "key" and "value" themselves if
+    * they're already that way. */
+   kms_request_str_t *lower_key;
+   kms_request_str_t *stripped_value;
+   /* the three above when they aren't shared, NULL until needed and kept for
+    * reuse */
+   kms_request_str_t *own_key;
+   kms_request_str_t *own_lower_key;
+   kms_request_str_t *own_stripped_value;
+} kms_header_t;
+
+/* case-insensitive, KMS_HEADER_UNKNOWN if it isn't a well-known header */
+kms_header_id_t
+kms_header_id (const char *key, size_t len);
+/* like strcmp of the headers' lowercase keys */
+int
+kms_header_cmp (const kms_header_t *a, const kms_header_t *b);
+
+/* headers sorted by lowercase key as they're added, headers with the same key
+ * stay in the order they were added */
+typedef struct {
+   kms_header_t *headers;
+   size_t len;
+   size_t size;
+   /* headers up to here have strings, those past "len" are kept for reuse
+    * after kms_header_list_clear or kms_header_list_del */
+   size_t allocated;
+   /* the header added most recently */
+   size_t last;
+   kms_arena_t *arena;
+} kms_header_list_t;
+
+kms_header_list_t *
+kms_header_list_new (void);
+/* the list, its entries, and their strings are allocated in "arena" */
+kms_header_list_t *
+kms_header_list_new_in (kms_arena_t *arena);
+void
+kms_header_list_destroy (kms_header_list_t *lst);
+kms_header_list_t *
+kms_header_list_dup (const kms_header_list_t *lst);
+/* remove all headers, keeping their memory */
+void
+kms_header_list_clear (kms_header_list_t *lst);
+void
+kms_header_list_add (kms_header_list_t *lst,
+                     const char *key,
+                     const char *value);
+/* from (pointer, length) slices */
+void
+kms_header_list_add_chars (kms_header_list_t *lst,
+                           const char *key,
+                           size_t key_len,
+                           const char *value,
+                           size_t value_len);
+/* append to the value of the header added most recently, false if none */
+bool
+kms_header_list_append_value (kms_header_list_t *lst,
+                              const char *value,
+                              size_t len);
+/* case-insensitive, the first header with this key */
+const kms_header_t *
+kms_header_list_find (const kms_header_list_t *lst, const char *key);
+/* case-insensitive, set the value of the only header with this key in place,
+ * as if it were deleted and added again. false if there isn't exactly one. */
+bool
+kms_header_list_replace_value (kms_header_list_t *lst,
+                               const char *key,
+                               const char *value);
+/* case-insensitive, all headers with this key */
+void
+kms_header_list_del (kms_header_list_t *lst, const char *key);
+
+/* walks two lists in order as if they were one, for a clone of a prototype:
+ * the prototype's headers and the clone's own. Either may be NULL. */
+typedef struct {
+   const kms_header_list_t *lists[2];
+   size_t pos[2];
+} kms_header_iter_t;
+
+void
+kms_header_iter_init (kms_header_iter_t *iter,
+                      const kms_header_list_t *first,
+                      const kms_header_list_t *second);
+/* NULL after the last header */
+const kms_header_t *
+kms_header_iter_next (kms_header_iter_t *iter);
+
+#endif /* KMS_HEADER_LIST_H */
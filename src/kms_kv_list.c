@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 
+#include "kms_alloc.h"
 #include "kms_kv_list.h"
 #include "kms_message/kms_message.h"
 #include "kms_request_str.h"
@@ -26,6 +27,18 @@ kv_init (kms_kv_t *kv, kms_request_str_t *key, kms_request_str_t *value)
    kv->value = kms_request_str_dup (value);
 }
 
+/* reuse the strings of an entry kms_kv_list_clear kept */
+static void
+kv_set (kms_kv_t *kv,
+        const char *key,
+        size_t key_len,
+        const char *value,
+        size_t value_len)
+{
+   kms_request_str_set_chars (kv->key, key, (ssize_t) key_len);
+   kms_request_str_set_chars (kv->value, value, (ssize_t) value_len);
+}
+
 static void
 kv_cleanup (kms_kv_t *kv)
 {
@@ -36,11 +49,19 @@ kv_cleanup (kms_kv_t *kv)
 kms_kv_list_t *
 kms_kv_list_new (void)
 {
-   kms_kv_list_t *lst = malloc (sizeof (kms_kv_list_t));
+   return kms_kv_list_new_in (NULL);
+}
 
+kms_kv_list_t *
+kms_kv_list_new_in (kms_arena_t *arena)
+{
+   kms_kv_list_t *lst = kms_arena_alloc (arena, sizeof (kms_kv_list_t));
+
+   lst->arena = arena;
    lst->size = 16;
-   lst->kvs = malloc (lst->size * sizeof (kms_kv_t));
+   lst->kvs = kms_arena_alloc (arena, lst->size * sizeof (kms_kv_t));
    lst->len = 0;
+   lst->allocated = 0;
 
    return lst;
 }
@@ -54,12 +75,32 @@ kms_kv_list_destroy (kms_kv_list_t *lst)
       return;
    }
 
-   for (i = 0; i < lst->len; i++) {
+   for (i = 0; i < lst->allocated; i++) {
       kv_cleanup (&lst->kvs[i]);
    }
 
-   free (lst->kvs);
-   free (lst);
+   kms_arena_free (lst->arena, lst->kvs);
+   kms_arena_free (lst->arena, lst);
+}
+
+void
+kms_kv_list_clear (kms_kv_list_t *lst)
+{
+   lst->len = 0;
+}
+
+static kms_kv_t *
+next_kv (kms_kv_list_t *lst)
+{
+   if (lst->len == lst->size) {
+      lst->kvs = kms_arena_realloc (lst->arena,
+                                    lst->kvs,
+                                    lst->size * sizeof (kms_kv_t),
+                                    2 * lst->size * sizeof (kms_kv_t));
+      lst->size *= 2;
+   }
+
+   return &lst->kvs[lst->len++];
 }
 
 void
@@ -67,13 +108,42 @@ kms_kv_list_add (kms_kv_list_t *lst,
                  kms_request_str_t *key,
                  kms_request_str_t *value)
 {
-   if (lst->len == lst->size) {
-      lst->size *= 2;
-      lst->kvs = realloc (lst->kvs, lst->size * sizeof (kms_kv_t));
+   kms_kv_list_add_chars (lst, key->str, key->len, value->str, value->len);
+}
+
+void
+kms_kv_list_add_chars (kms_kv_list_t *lst,
+                       const char *key,
+                       size_t key_len,
+                       const char *value,
+                       size_t value_len)
+{
+   kms_kv_t *kv = next_kv (lst);
+
+   if (lst->len > lst->allocated) {
+      kv->key = kms_request_str_new_in (lst->arena);
+      kv->value = kms_request_str_new_in (lst->arena);
+      lst->allocated = lst->len;
+   }
+
+   kv_set (kv, key, key_len, value, value_len);
+}
+
+void
+kms_kv_list_add_owned (kms_kv_list_t *lst,
+                       kms_request_str_t *key,
+                       kms_request_str_t *value)
+{
+   kms_kv_t *kv = next_kv (lst);
+
+   if (lst->len > lst->allocated) {
+      lst->allocated = lst->len;
+   } else {
+      kv_cleanup (kv);
    }
 
-   kv_init (&lst->kvs[lst->len], key, value);
-   ++lst->len;
+   kv->key = key;
+   kv->value = value;
 }
 
 const kms_kv_t *
@@ -94,14 +164,16 @@ void
 kms_kv_list_del (kms_kv_list_t *lst, const char *key)
 {
    size_t i;
+   kms_kv_t removed;
 
    for (i = 0; i < lst->len; i++) {
       if (0 == strcmp (lst->kvs[i].key->str, key)) {
-         kv_cleanup (&lst->kvs[i]);
+         /* keep its strings after the last entry, for reuse */
+         removed = lst->kvs[i];
          memmove (&lst->kvs[i],
                   &lst->kvs[i + 1],
                   sizeof (kms_kv_t) * (lst->len - i - 1));
-         lst->len--;
+         lst->kvs[--lst->len] = removed;
       }
    }
 }
@@ -116,9 +188,10 @@ kms_kv_list_dup (const kms_kv_list_t *lst)
       return kms_kv_list_new ();
    }
 
-   dup = malloc (sizeof (kms_kv_list_t));
-   dup->size = dup->len = lst->len;
-   dup->kvs = malloc (lst->len * sizeof (kms_kv_t));
+   dup = kms_malloc (sizeof (kms_kv_list_t));
+   dup->arena = NULL;
+   dup->size = dup->len = dup->allocated = lst->len;
+   dup->kvs = kms_malloc (lst->len * sizeof (kms_kv_t));
 
    for (i = 0; i < lst->len; i++) {
       kv_init (&dup->kvs[i], lst->kvs[i].key, lst->kvs[i].value);
@@ -34,16 +34,39 @@ typedef struct {
    kms_kv_t *kvs;
    size_t len;
    size_t size;
+   /* entries up to here have strings, those past "len" are kept for reuse
+    * after kms_kv_list_clear or kms_kv_list_del */
+   size_t allocated;
+   kms_arena_t *arena;
 } kms_kv_list_t;
 
 kms_kv_list_t *
 kms_kv_list_new (void);
+/* the list, its entries, and their strings are allocated in "arena" */
+kms_kv_list_t *
+kms_kv_list_new_in (kms_arena_t *arena);
 void
 kms_kv_list_destroy (kms_kv_list_t *lst);
+/* remove all entries, keeping their memory */
+void
+kms_kv_list_clear (kms_kv_list_t *lst);
 void
 kms_kv_list_add (kms_kv_list_t *lst,
                  kms_request_str_t *key,
                  kms_request_str_t *value);
+/* from (pointer, length) slices, into the strings of an entry that was
+ * cleared or deleted if there is one */
+void
+kms_kv_list_add_chars (kms_kv_list_t *lst,
+                       const char *key,
+                       size_t key_len,
+                       const char *value,
+                       size_t value_len);
+/* takes ownership of "key" and "value" instead of copying them */
+void
+kms_kv_list_add_owned (kms_kv_list_t *lst,
+                       kms_request_str_t *key,
+                       kms_request_str_t *value);
 const kms_kv_t *
 kms_kv_list_find (const kms_kv_list_t *lst, const char *key);
 void
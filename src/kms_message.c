@@ -16,6 +16,7 @@
  */
 
 #include "b64.h"
+#include "kms_crypto.h"
 #include "kms_message/kms_message.h"
 #include "kms_message_private.h"
 
@@ -34,12 +35,19 @@ set_error (char *error, size_t size, const char *fmt, ...)
 
 void
 kms_message_init (void)
+{
+   (void) kms_message_init_with_crypto (KMS_CRYPTO_DEFAULT);
+}
+
+bool
+kms_message_init_with_crypto (kms_crypto_backend_t backend)
 {
    kms_message_b64_initialize_rmap ();
+   return kms_crypto_set_backend (backend);
 }
 
 void
 kms_message_cleanup (void)
 {
-   /* nothing yet */
+   kms_crypto_cleanup ();
 }
@@ -24,4 +24,19 @@ kms_decrypt_request_new (const uint8_t *ciphertext_blob,
                          size_t len,
                          const kms_request_opt_t *opt);
 
+/* Make "request" a new Decrypt request, reusing its memory. Set its
+ * credentials again afterward. See kms_request_reset. */
+KMS_MSG_EXPORT (bool)
+kms_decrypt_request_reset (kms_request_t *request,
+                           const uint8_t *ciphertext_blob,
+                           size_t len,
+                           const kms_request_opt_t *opt);
+
+/* The same, cloned from a prototype of kms_decrypt_request_new (NULL, 0, opt)
+ * with its credentials set. See kms_request_proto_new. */
+KMS_MSG_EXPORT (kms_request_t *)
+kms_decrypt_request_new_from_proto (const kms_request_proto_t *proto,
+                                    const uint8_t *ciphertext_blob,
+                                    size_t len);
+
 #endif /* KMS_DECRYPT_REQUEST_H */
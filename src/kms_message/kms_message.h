@@ -19,9 +19,14 @@
 
 #include "kms_message_defines.h"
 #include "kms_request_opt.h"
+#include "kms_signer.h"
 #include "kms_request.h"
+#include "kms_request_proto.h"
+#include "kms_presign.h"
 #include "kms_response.h"
 #include "kms_response_parser.h"
+#include "kms_retry.h"
+#include "kms_sign_pool.h"
 #include "kms_decrypt_request.h"
 #include "kms_encrypt_request.h"
 
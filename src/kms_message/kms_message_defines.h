@@ -17,6 +17,9 @@
 #ifndef KMS_MESSAGE_DEFINES_H
 #define KMS_MESSAGE_DEFINES_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef _MSC_VER
 #ifdef KMS_MSG_STATIC
@@ -40,9 +43,51 @@
 
 #define KMS_MSG_EXPORT(type) KMS_MSG_API type KMS_MSG_CALL
 
+/* where SHA-256 and HMAC come from */
+typedef enum {
+   KMS_CRYPTO_DEFAULT, /* OpenSSL if the library was built with it */
+   KMS_CRYPTO_OPENSSL,
+   KMS_CRYPTO_BUILTIN /* uses SHA-NI or AVX2 when the CPU has them */
+} kms_crypto_backend_t;
+
 KMS_MSG_EXPORT (void)
 kms_message_init (void);
+KMS_MSG_EXPORT (bool)
+kms_message_init_with_crypto (kms_crypto_backend_t backend);
+/* frees the digest contexts every thread has cached, including threads that
+ * are still running: no thread may be using the library meanwhile */
 KMS_MSG_EXPORT (void)
 kms_message_cleanup (void);
 
+/* where the library's memory comes from. "ctx" is passed to each. */
+typedef struct {
+   void *(*malloc) (size_t size, void *ctx);
+   void *(*realloc) (void *ptr, size_t size, void *ctx);
+   void (*free) (void *ptr, void *ctx);
+   void *ctx;
+} kms_allocator_t;
+
+/* Like kms_message_init_with_crypto, and allocate with "allocator" from now
+ * on, or with the C library again if it's NULL. Call it before creating any
+ * objects, not while others exist. Strings the library returns, like
+ * kms_request_get_signed's, come from the allocator too: free them with
+ * kms_message_free. OpenSSL's own allocations don't go through it, install
+ * it with CRYPTO_set_mem_functions for that. */
+KMS_MSG_EXPORT (bool)
+kms_message_init_with_allocator (kms_crypto_backend_t backend,
+                                 const kms_allocator_t *allocator);
+/* free a string the library returned, the same as free () unless an
+ * allocator was installed */
+KMS_MSG_EXPORT (void)
+kms_message_free (void *ptr);
+
+/* the time in seconds since the epoch, for requests dated "now" */
+typedef int64_t (*kms_clock_t) (void *ctx);
+
+/* Date requests with "clock" instead of the real-time clock, or with the
+ * real-time clock again if "clock" is NULL. Call it before making requests,
+ * not while other threads make them. */
+KMS_MSG_EXPORT (void)
+kms_message_set_clock (kms_clock_t clock, void *ctx);
+
 #endif /* KMS_MESSAGE_DEFINES_H */
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_PRESIGN_H
+#define KMS_PRESIGN_H
+
+#include "kms_message_defines.h"
+#include "kms_request.h"
+
+#include <time.h>
+
+/* A template for presigned URLs, SigV4 with the signature in the query
+ * string. It canonicalizes a request's method, path, query, and headers once,
+ * so each URL costs only the date, the expiry, and the signature. The request
+ * may be destroyed afterward, but a signer it uses must outlive the template.
+ * Sign S3 URLs with kms_request_set_unsigned_payload. */
+typedef struct _kms_presign_template_t kms_presign_template_t;
+
+KMS_MSG_EXPORT (kms_presign_template_t *)
+kms_presign_template_new (kms_request_t *request);
+KMS_MSG_EXPORT (void)
+kms_presign_template_destroy (kms_presign_template_t *tmpl);
+KMS_MSG_EXPORT (const char *)
+kms_presign_template_get_error (kms_presign_template_t *tmpl);
+/* Returns the path and query of a URL valid for "expires" seconds from "tm",
+ * or from now if "tm" is NULL, like "/test.txt?X-Amz-Algorithm=...&
+ * X-Amz-Signature=...". Prepend the scheme and host. */
+KMS_MSG_EXPORT (char *)
+kms_presign_template_sign (kms_presign_template_t *tmpl,
+                           const struct tm *tm,
+                           int expires);
+
+#endif /* KMS_PRESIGN_H */
@@ -32,10 +32,22 @@ kms_request_new (const char *method,
                  const kms_request_opt_t *opt);
 KMS_MSG_EXPORT (void)
 kms_request_destroy (kms_request_t *request);
+/* Make "request" like a new one from kms_request_new, reusing its memory.
+ * Returns false and sets an error if the query can't be parsed. */
+KMS_MSG_EXPORT (bool)
+kms_request_reset (kms_request_t *request,
+                   const char *method,
+                   const char *path_and_query,
+                   const kms_request_opt_t *opt);
 KMS_MSG_EXPORT (const char *)
 kms_request_get_error (kms_request_t *request);
 KMS_MSG_EXPORT (bool)
 kms_request_set_date (kms_request_t *request, const struct tm *tm);
+/* Date a signed request "tm", or now if NULL, and sign it again, as for a
+ * retry. Only what depends on the date is redone: the payload hash, canonical
+ * path and query, and signed headers are reused. */
+KMS_MSG_EXPORT (bool)
+kms_request_resign (kms_request_t *request, const struct tm *tm);
 KMS_MSG_EXPORT (bool)
 kms_request_set_region (kms_request_t *request, const char *region);
 KMS_MSG_EXPORT (bool)
@@ -45,6 +57,15 @@ kms_request_set_access_key_id (kms_request_t *request, const char *akid);
 KMS_MSG_EXPORT (bool)
 kms_request_set_secret_key (kms_request_t *request, const char *key);
 KMS_MSG_EXPORT (bool)
+kms_request_set_signer (kms_request_t *request, kms_signer_t *signer);
+/* Sign with a SigV4 signing key derived elsewhere for "date", like "20150830",
+ * and the request's region and service, instead of a secret key. Set the
+ * request date first: fails if it is not "date". */
+KMS_MSG_EXPORT (bool)
+kms_request_set_signing_key (kms_request_t *request,
+                             const unsigned char *key,
+                             const char *date);
+KMS_MSG_EXPORT (bool)
 kms_request_add_header_field (kms_request_t *request,
                               const char *field_name,
                               const char *value);
@@ -56,6 +77,35 @@ KMS_MSG_EXPORT (bool)
 kms_request_append_payload (kms_request_t *request,
                             const char *payload,
                             size_t len);
+/* Attach "payload" without copying it, in place of kms_request_append_payload.
+ * The request reads it until it's destroyed or reset, so it must outlive the
+ * request and not change. Hashed now unless a hash was supplied or the payload
+ * is unsigned. */
+KMS_MSG_EXPORT (bool)
+kms_request_set_payload_ref (kms_request_t *request,
+                             const char *payload,
+                             size_t len);
+/* Sign with a SHA-256 of the payload that the caller already has, instead of
+ * hashing the payload. "hash" is 32 bytes, "hex" is 64 hex digits. */
+KMS_MSG_EXPORT (bool)
+kms_request_set_payload_hash (kms_request_t *request,
+                              const unsigned char *hash);
+KMS_MSG_EXPORT (bool)
+kms_request_set_payload_hash_hex (kms_request_t *request, const char *hex);
+/* Sign "UNSIGNED-PAYLOAD" in place of the payload hash, for services that
+ * accept it, like S3. The payload isn't hashed. */
+KMS_MSG_EXPORT (bool)
+kms_request_set_unsigned_payload (kms_request_t *request);
+/* Send the body with aws-chunked encoding, signed chunk by chunk as S3's
+ * STREAMING-AWS4-HMAC-SHA256-PAYLOAD. The body is "decoded_len" bytes sent in
+ * chunks of "chunk_size", except that the last may be shorter. The request
+ * gets the matching headers, and kms_request_get_signed returns only the
+ * head. Then pass each chunk to kms_request_sign_chunk, and finally an empty
+ * one. */
+KMS_MSG_EXPORT (bool)
+kms_request_set_streaming_payload (kms_request_t *request,
+                                   size_t decoded_len,
+                                   size_t chunk_size);
 KMS_MSG_EXPORT (char *)
 kms_request_get_canonical (kms_request_t *request);
 KMS_MSG_EXPORT (char *)
@@ -67,4 +117,40 @@ kms_request_get_signature (kms_request_t *request);
 KMS_MSG_EXPORT (char *)
 kms_request_get_signed (kms_request_t *request);
 
+/* A piece of a signed request, like POSIX struct iovec. */
+typedef struct {
+   const void *base;
+   size_t len;
+} kms_iovec_t;
+
+#define KMS_SIGNED_IOV_MAX 4
+
+/* The signed request as up to KMS_SIGNED_IOV_MAX pieces, for writev: the
+ * request line and headers, the signature, and the payload, which isn't
+ * copied. They point into "request" and are valid until it's changed or
+ * destroyed. */
+KMS_MSG_EXPORT (bool)
+kms_request_get_signed_iov (kms_request_t *request,
+                            kms_iovec_t *iov,
+                            size_t *iovcnt);
+/* The length of the signed request, without a terminating nul. */
+KMS_MSG_EXPORT (bool)
+kms_request_get_signed_len (kms_request_t *request, size_t *len);
+/* Write the signed request to "buf", nul-terminated if there's room. Returns
+ * false if "size" is less than kms_request_get_signed_len's. */
+KMS_MSG_EXPORT (bool)
+kms_request_write_signed (kms_request_t *request, char *buf, size_t size);
+/* Signs "n" requests at once, hashing several of them in parallel when the CPU
+ * has AVX2 or AVX-512. Sets signed_out[i] to what kms_request_get_signed would
+ * return for requests[i], or NULL if that request failed, in which case
+ * kms_request_get_error describes it. Returns true if all succeeded. Always
+ * uses the built-in SHA-256, whatever the crypto backend. */
+KMS_MSG_EXPORT (bool)
+kms_request_sign_batch (kms_request_t **requests, size_t n, char **signed_out);
+/* Signs the next chunk of a streaming payload. Returns the line to send before
+ * the "len" bytes of "data", like "400;chunk-signature=...\r\n". Send "\r\n"
+ * after the data. The chunk is not copied. */
+KMS_MSG_EXPORT (char *)
+kms_request_sign_chunk (kms_request_t *request, const char *data, size_t len);
+
 #endif /* KMS_REQUEST_H */
@@ -20,6 +20,7 @@
 #include "kms_message_defines.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct _kms_request_opt_t kms_request_opt_t;
 
@@ -30,5 +31,23 @@ kms_request_opt_destroy (kms_request_opt_t *request);
 KMS_MSG_EXPORT (void)
 kms_request_opt_set_connection_close (kms_request_opt_t *opt,
                                       bool connection_close);
+/* add an "X-Amz-Content-Sha256" header with the payload hash, as S3 requires */
+KMS_MSG_EXPORT (void)
+kms_request_opt_set_content_sha256 (kms_request_opt_t *opt,
+                                    bool content_sha256);
+/* allocate a request's headers, query, path, and other strings from one
+ * arena, freed all at once when the request is destroyed. the arena starts
+ * in "block" if it's not NULL, which must outlive the request and can't be
+ * shared with another, and takes "chunk_size" bytes at a time from the
+ * allocator after that, or a default if 0. strings returned to the caller
+ * are still allocated one by one, and so is the payload. kms_request_reset
+ * keeps the arena the request was created with, and ignores this option.
+ * "block" needn't be aligned, but up to 15 bytes at its start are skipped to
+ * reach a 16-byte boundary. */
+KMS_MSG_EXPORT (void)
+kms_request_opt_set_arena (kms_request_opt_t *opt,
+                           void *block,
+                           size_t block_size,
+                           size_t chunk_size);
 
 #endif /* KMS_REQUEST_OPT_H */
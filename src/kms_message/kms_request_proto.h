@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_REQUEST_PROTO_H
+#define KMS_REQUEST_PROTO_H
+
+#include "kms_message_defines.h"
+#include "kms_request.h"
+
+/* A prototype freezes the parts of a request that are the same every time:
+ * the method, the path and query, already normalized and escaped for signing,
+ * the credentials or signer, and the headers but X-Amz-Date, sorted, with Host
+ * added if missing. The payload and date are left out. Each
+ * kms_request_new_from_proto borrows all that instead of copying it, and
+ * allocates what it fills in, its date, payload, and signature, in one block
+ * sized from the prototype. A payload longer than a few hundred bytes grows
+ * past it: borrow a large one with kms_request_set_payload_ref instead.
+ *
+ * The request may be destroyed afterward, the prototype must outlive its
+ * clones. Nothing changes the prototype after kms_request_proto_new, so clones
+ * may be made from it on several threads at once; a signer it uses must still
+ * be used by one thread at a time. */
+typedef struct _kms_request_proto_t kms_request_proto_t;
+
+KMS_MSG_EXPORT (kms_request_proto_t *)
+kms_request_proto_new (kms_request_t *request);
+KMS_MSG_EXPORT (void)
+kms_request_proto_destroy (kms_request_proto_t *proto);
+KMS_MSG_EXPORT (const char *)
+kms_request_proto_get_error (const kms_request_proto_t *proto);
+/* A new request like the prototype's, dated now. Set its payload, and maybe
+ * its date, then sign it as usual. */
+KMS_MSG_EXPORT (kms_request_t *)
+kms_request_new_from_proto (const kms_request_proto_t *proto);
+
+#endif /* KMS_REQUEST_PROTO_H */
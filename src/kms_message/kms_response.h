@@ -21,6 +21,7 @@
 
 typedef struct _kms_response_t kms_response_t;
 
+KMS_MSG_EXPORT (int) kms_response_get_status (kms_response_t *reply);
 KMS_MSG_EXPORT (const char *) kms_response_get_body (kms_response_t *reply);
 KMS_MSG_EXPORT (void) kms_response_destroy (kms_response_t *reply);
 
@@ -33,9 +33,22 @@ kms_response_parser_feed (kms_response_parser_t *parser,
                           uint8_t *buf,
                           uint32_t len);
 
+/* Takes the response, so the parser allocates a new one for the next. To
+ * parse without allocating, use kms_response_parser_peek_response and
+ * kms_response_parser_reset instead. */
 KMS_MSG_EXPORT (kms_response_t *)
 kms_response_parser_get_response (kms_response_parser_t *parser);
 
+/* The response without taking it, valid until the parser is fed, reset, or
+ * destroyed. Together with kms_response_parser_reset, one parser can parse
+ * response after response without allocating once its buffers have grown. */
+KMS_MSG_EXPORT (kms_response_t *)
+kms_response_parser_peek_response (kms_response_parser_t *parser);
+
+/* Discard the response and start on the next, keeping the parser's memory. */
+KMS_MSG_EXPORT (void)
+kms_response_parser_reset (kms_response_parser_t *parser);
+
 KMS_MSG_EXPORT (void)
 kms_response_parser_destroy (kms_response_parser_t *parser);
 
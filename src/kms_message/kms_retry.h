@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_RETRY_H
+#define KMS_RETRY_H
+
+#include "kms_message.h"
+#include "kms_request.h"
+#include "kms_response.h"
+
+/* Decides whether and when to send a request again after a throttling or
+ * server error, with exponential backoff and full jitter: before the nth retry
+ * it waits a random time up to base_ms * 2^(n-1), but no more than max_ms.
+ * Use one per request at a time, it isn't thread-safe. */
+typedef struct _kms_retry_t kms_retry_t;
+
+/* "max_attempts" counts the first attempt too. */
+KMS_MSG_EXPORT (kms_retry_t *)
+kms_retry_new (int max_attempts, int64_t base_ms, int64_t max_ms);
+
+KMS_MSG_EXPORT (void)
+kms_retry_destroy (kms_retry_t *retry);
+
+/* Forget past attempts, to retry another request. */
+KMS_MSG_EXPORT (void)
+kms_retry_reset (kms_retry_t *retry);
+
+/* Make the delays repeatable, for tests. */
+KMS_MSG_EXPORT (void)
+kms_retry_set_seed (kms_retry_t *retry, uint64_t seed);
+
+/* True if "response" is throttling or a server error. */
+KMS_MSG_EXPORT (bool)
+kms_response_is_retryable (kms_response_t *response);
+
+/* Call with each response to "request". If it should be sent again, re-signs
+ * it with kms_request_resign, dated when it's due, sets "delay_ms" to how long
+ * to wait before sending it, and returns true. Returns false if the response
+ * isn't retryable, there are no attempts left, or re-signing failed: see
+ * kms_request_get_error. */
+KMS_MSG_EXPORT (bool)
+kms_retry_next (kms_retry_t *retry,
+                kms_request_t *request,
+                kms_response_t *response,
+                int64_t *delay_ms);
+
+#endif /* KMS_RETRY_H */
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_SIGN_POOL_H
+#define KMS_SIGN_POOL_H
+
+#include "kms_message.h"
+#include "kms_request.h"
+
+/* Threads that sign a batch of requests together, each thread taking a few
+ * requests at a time and taking more from the others when it runs out. */
+typedef struct _kms_sign_pool_t kms_sign_pool_t;
+
+/* "n_threads" counts the calling thread, which signs too. 0 means one per
+ * online CPU. */
+KMS_MSG_EXPORT (kms_sign_pool_t *)
+kms_sign_pool_new (int n_threads);
+
+KMS_MSG_EXPORT (void)
+kms_sign_pool_destroy (kms_sign_pool_t *pool);
+
+/* Like kms_request_sign_batch, spread across the pool's threads. The requests
+ * must be distinct. Requests may share a signer, which no other thread may use
+ * meanwhile. Call from one thread at a time. */
+KMS_MSG_EXPORT (bool)
+kms_sign_pool_sign (kms_sign_pool_t *pool,
+                    kms_request_t **requests,
+                    size_t n,
+                    char **signed_out);
+
+#endif /* KMS_SIGN_POOL_H */
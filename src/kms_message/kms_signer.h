@@ -0,0 +1,38 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_SIGNER_H
+#define KMS_SIGNER_H
+
+#include "kms_message_defines.h"
+
+/* A signer holds long-lived credentials, region, and service, and caches the
+ * SigV4 signing key derived from them for each date. Attach it to requests
+ * with kms_request_set_signer. The signer must outlive those requests. Setting
+ * a request's region, service, or credentials afterward detaches the signer.
+ * A signer is not thread-safe: use one per thread or synchronize externally.
+ */
+typedef struct _kms_signer_t kms_signer_t;
+
+KMS_MSG_EXPORT (kms_signer_t *)
+kms_signer_new (const char *access_key_id,
+                const char *secret_key,
+                const char *region,
+                const char *service);
+KMS_MSG_EXPORT (void)
+kms_signer_destroy (kms_signer_t *signer);
+
+#endif /* KMS_SIGNER_H */
@@ -18,13 +18,48 @@
 #define KMS_MESSAGE_PRIVATE_H
 
 #include "kms_message/kms_message.h"
+#include "kms_crypto.h"
+#include "kms_header_list.h"
 #include "kms_request_str.h"
 #include "kms_kv_list.h"
+#include "kms_sha256.h"
+
+/* a signing key derived for one date, plus strings that depend on the date */
+typedef struct {
+   char date[sizeof "YYYYmmDD"]; /* empty if the slot is unused */
+   unsigned char key[32];
+   kms_hmac_sha256_key_t hmac; /* "key" after the HMAC key schedule */
+   /* the same, as built-in SHA-256 states for kms_request_sign_batch */
+   uint32_t hmac_inner[8];
+   uint32_t hmac_outer[8];
+   /* like "20150830/us-east-1/service/aws4_request" */
+   kms_request_str_t *scope;
+   /* like "AWS4-HMAC-SHA256 Credential=AKIDEXAMPLE/20150830/..." */
+   kms_request_str_t *credential;
+} kms_signer_slot_t;
+
+struct _kms_signer_t {
+   kms_request_str_t *access_key_id;
+   kms_request_str_t *secret_key;
+   kms_request_str_t *region;
+   kms_request_str_t *service;
+   /* today's key and, near midnight UTC, tomorrow's */
+   kms_signer_slot_t slots[2];
+};
+
+typedef enum {
+   PAYLOAD_HASH_COMPUTED, /* hash "payload" as it's appended */
+   PAYLOAD_HASH_SUPPLIED, /* the caller set "payload_hash" */
+   PAYLOAD_UNSIGNED,      /* sign "UNSIGNED-PAYLOAD" instead of a hash */
+   PAYLOAD_STREAMING      /* aws-chunked, see kms_request_sign_chunk */
+} kms_payload_hash_mode_t;
 
 struct _kms_request_t {
    char error[512];
    bool failed;
    bool finalized;
+   /* from kms_request_opt_set_arena, NULL for malloc. it owns the request. */
+   kms_arena_t *arena;
    kms_request_str_t *region;
    kms_request_str_t *service;
    kms_request_str_t *access_key_id;
@@ -33,12 +68,116 @@ struct _kms_request_t {
    kms_request_str_t *path;
    kms_request_str_t *query;
    kms_request_str_t *payload;
+   /* from kms_request_set_payload_ref, read in place instead of "payload" */
+   const char *payload_ref;
+   size_t payload_ref_len;
+   kms_payload_hash_mode_t payload_hash_mode;
+   /* running hash of "payload", NULL until the first append */
+   kms_sha256_ctx_t *payload_hash_ctx;
+   /* hash of "payload", computed on demand from payload_hash_ctx */
+   unsigned char payload_hash[32];
+   bool payload_hash_valid;
+   /* add "X-Amz-Content-Sha256" when finalizing */
+   bool content_sha256;
+   /* for PAYLOAD_STREAMING: the body's length, the size of each chunk but
+    * the last, and the bytes signed so far */
+   size_t decoded_len;
+   size_t chunk_size;
+   size_t chunked_len;
+   /* the last signature in the chain, starting with the request's */
+   bool chunk_seeded;
+   unsigned char chunk_signature[32];
+   kms_hmac_sha256_key_t chunk_hmac;
    kms_request_str_t *datetime;
    kms_request_str_t *date;
    kms_kv_list_t *query_params;
-   kms_kv_list_t *header_fields;
+   /* sorted for the canonical query */
+   bool query_sorted;
+   kms_header_list_t *header_fields;
+   /* a clone of a prototype borrows the prototype's method, path, query,
+    * query_params, and canonical_path, and its credentials until a setter
+    * changes them. Its headers are the prototype's, in "proto_headers", plus
+    * its own in "header_fields". */
+   bool shares_target;
+   bool shares_credentials;
+   const kms_header_list_t *proto_headers;
+   /* not owned, may be NULL */
+   kms_signer_t *signer;
+   /* from kms_request_set_signing_key, used instead of "secret_key" */
+   bool has_signing_key;
+   unsigned char signing_key[32];
+   char signing_key_date[sizeof "YYYYmmDD"];
+   /* the region or service changed since, so the key is for another scope */
+   bool signing_key_rescoped;
    /* turn off for tests only, not in public kms_request_opt_t API */
    bool auto_content_length;
+   /* memoized by the getters until a setter invalidates them: changing the
+    * headers, payload, or date invalidates all, changing the credentials only
+    * the string to sign and signature */
+   bool canonical_valid; /* signed_headers */
+   bool canonical_str_valid;
+   bool canonical_hash_valid;
+   bool sts_valid;
+   bool signature_valid;
+   /* normalized and escaped, NULL until the canonical request is built */
+   bool canonical_path_valid;
+   kms_request_str_t *canonical_path;
+   kms_request_str_t *signed_headers;
+   unsigned char canonical_hash[32];
+   /* only built for kms_request_get_canonical and kms_request_sign_batch,
+    * signing hashes the canonical request as it's written */
+   kms_request_str_t *canonical;
+   kms_request_str_t *string_to_sign;
+   unsigned char signature[32];
+   kms_request_str_t *authorization;
+   /* the signed request up to the Authorization header's value */
+   bool signed_head_valid;
+   kms_request_str_t *signed_head;
+};
+
+struct _kms_presign_template_t {
+   char error[512];
+   bool failed;
+   kms_request_str_t *path;
+   kms_request_str_t *region;
+   kms_request_str_t *service;
+   /* like "GET\n/test.txt\n" */
+   kms_request_str_t *creq_head;
+   /* the canonical query, split where the credential's date, X-Amz-Date, and
+    * X-Amz-Expires go */
+   kms_request_str_t *query[4];
+   /* like "\nhost:example.com\n\nhost\nUNSIGNED-PAYLOAD" */
+   kms_request_str_t *creq_tail;
+   /* the request's signer, or one made from its credentials */
+   kms_signer_t *signer;
+   bool owns_signer;
+   /* or a key from kms_request_set_signing_key */
+   bool has_signing_key;
+   unsigned char signing_key[32];
+   char signing_key_date[sizeof "YYYYmmDD"];
+};
+
+struct _kms_request_proto_t {
+   char error[512];
+   bool failed;
+   /* never changed after kms_request_proto_new, so clones on any thread can
+    * borrow its strings and headers */
+   kms_request_t *frozen;
+   /* what a clone reserves for its signed head, signed headers, and
+    * Authorization header, and the arena chunk it's allocated in */
+   size_t head_len;
+   size_t signed_headers_len;
+   size_t auth_len;
+   size_t clone_size;
+};
+
+struct _kms_retry_t {
+   int max_attempts;
+   /* made so far, including the first */
+   int attempts;
+   int64_t base_ms;
+   int64_t max_ms;
+   uint64_t rand_state;
 };
 
 struct _kms_response_t {
@@ -58,12 +197,65 @@ struct _kms_response_parser_t {
    char error[512];
    bool failed;
    kms_response_t *response;
+   /* a reset response's body, kept for the next response's */
+   kms_request_str_t *spare_body;
    kms_request_str_t *raw_response;
    int content_length;
    int start; /* start of the current thing getting parsed. */
    kms_response_parser_state_t state;
 };
 
+bool
+kms_derive_signing_key (kms_request_str_t *secret_key,
+                        kms_request_str_t *date,
+                        kms_request_str_t *region,
+                        kms_request_str_t *service,
+                        unsigned char *key);
+
+const kms_signer_slot_t *
+kms_signer_get_slot (kms_signer_t *signer,
+                     kms_request_str_t *date,
+                     kms_request_str_t *datetime);
+/* true if kms_signer_get_slot would only read "signer" for this date */
+bool
+kms_signer_has_slot (const kms_signer_t *signer,
+                     const kms_request_str_t *date,
+                     const kms_request_str_t *datetime);
+
+/* one request's state in kms_request_sign_batch */
+typedef struct {
+   kms_request_t *request;
+   /* NULL if the request's signature is still valid */
+   kms_sha256_lane_t *lane;
+   uint32_t hmac_inner[8];
+   uint32_t hmac_outer[8];
+   unsigned char inner[32]; /* inner HMAC of the string to sign */
+   unsigned char signature[32];
+   char **signed_out;
+} kms_batch_item_t;
+
+/* kms_request_sign_batch with the caller's scratch space, "n" items and lanes,
+ * so it doesn't allocate but for the results */
+bool
+kms_request_sign_batch_with (kms_request_t **requests,
+                             size_t n,
+                             char **signed_out,
+                             kms_batch_item_t *items,
+                             kms_sha256_lane_t *lanes);
+
+/* kms_request_new_from_proto with room in the clone's arena for a payload of
+ * "payload_len" bytes, so a clone with its payload takes one allocation */
+kms_request_t *
+kms_request_new_from_proto_sized (const kms_request_proto_t *proto,
+                                  size_t payload_len);
+
+/* appends "data" to the payload base64-encoded, a piece at a time so the
+ * payload is the only copy */
+bool
+kms_request_append_payload_b64 (kms_request_t *request,
+                                const uint8_t *data,
+                                size_t len);
+
 #define CHECK_FAILED         \
    do {                      \
       if (request->failed) { \
@@ -15,45 +15,127 @@
  * limitations under the License.
  */
 
+#include "b64.h"
+#include "kms_alloc.h"
+#include "kms_clock.h"
 #include "kms_crypto.h"
 #include "kms_message/kms_message.h"
 #include "kms_message_private.h"
 #include "kms_request_opt_private.h"
+#include "kms_sha256.h"
 
 #include <assert.h>
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
+#include <stdio.h>
+
+/* SHA-256 of the empty string */
+#define EMPTY_HASH \
+   "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+#define STREAMING_PAYLOAD "STREAMING-AWS4-HMAC-SHA256-PAYLOAD"
+/* a clone's arena space that doesn't depend on its prototype: the request,
+ * its header list and strings' structs, its own headers, and the string to
+ * sign */
+#define CLONE_FIXED_SIZE 4096
+/* a clone's own X-Amz-Date and Content-Length headers in its signed head */
+#define CLONE_HEADERS_LEN 64
 
-static kms_kv_list_t *
-parse_query_params (kms_request_str_t *q)
+static bool
+parse_query_params (kms_request_str_t *q, kms_kv_list_t *lst)
 {
-   kms_kv_list_t *lst = kms_kv_list_new ();
    char *p = q->str;
    char *end = q->str + q->len;
    char *amp, *equals;
-   kms_request_str_t *k, *v;
 
    do {
       equals = strchr ((const char *) p, '=');
       if (!equals) {
-         kms_kv_list_destroy (lst);
-         return NULL;
+         return false;
       }
       amp = strchr ((const char *) equals, '&');
       if (!amp) {
          amp = end;
       }
 
-      k = kms_request_str_new_from_chars (p, equals - p);
-      v = kms_request_str_new_from_chars (equals + 1, amp - equals - 1);
-      kms_kv_list_add (lst, k, v);
-      kms_request_str_destroy (k);
-      kms_request_str_destroy (v);
+      kms_kv_list_add_chars (
+         lst, p, equals - p, equals + 1, amp - equals - 1);
 
       p = amp + 1;
    } while (p < end);
 
-   return lst;
+   return true;
+}
+
+/* the credentials changed: keep the canonical request */
+static void
+invalidate_signature (kms_request_t *request)
+{
+   request->sts_valid = false;
+   request->signature_valid = false;
+}
+
+/* only the date changed, the signed headers are still valid */
+static void
+invalidate_date (kms_request_t *request)
+{
+   request->canonical_str_valid = false;
+   request->canonical_hash_valid = false;
+   request->signed_head_valid = false;
+   invalidate_signature (request);
+}
+
+/* the headers, payload, or date changed */
+static void
+invalidate (kms_request_t *request)
+{
+   request->canonical_valid = false;
+   invalidate_date (request);
+}
+
+/* what a new request and a clone of a prototype both fill in. with an arena
+ * the request itself is allocated there too, and the payload if the arena was
+ * sized for it. */
+static kms_request_t *
+request_alloc (kms_arena_t *arena, bool payload_in_arena)
+{
+   kms_request_t *request = kms_arena_alloc (arena, sizeof (kms_request_t));
+
+   memset (request, 0, sizeof (kms_request_t));
+   request->arena = arena;
+   /* otherwise it may be large, don't let it grow through the arena */
+   request->payload = kms_request_str_new_in (payload_in_arena ? arena : NULL);
+   request->date = kms_request_str_new_in (arena);
+   request->datetime = kms_request_str_new_in (arena);
+   request->header_fields = kms_header_list_new_in (arena);
+   request->auto_content_length = true;
+   request->signed_headers = kms_request_str_new_in (arena);
+   request->canonical = kms_request_str_new_in (arena);
+   request->string_to_sign = kms_request_str_new_in (arena);
+   request->authorization = kms_request_str_new_in (arena);
+   request->signed_head = kms_request_str_new_in (arena);
+
+   return request;
+}
+
+/* the strings a clone borrows from its prototype */
+static void
+alloc_target (kms_request_t *request)
+{
+   request->method = kms_request_str_new_in (request->arena);
+   request->path = kms_request_str_new_in (request->arena);
+   request->query = kms_request_str_new_in (request->arena);
+   request->query_params = kms_kv_list_new_in (request->arena);
+   request->canonical_path = NULL;
+   request->canonical_path_valid = false;
+   request->shares_target = false;
+}
+
+static void
+alloc_credentials (kms_request_t *request)
+{
+   request->region = kms_request_str_new_in (request->arena);
+   request->service = kms_request_str_new_in (request->arena);
+   request->access_key_id = kms_request_str_new_in (request->arena);
+   request->secret_key = kms_request_str_new_in (request->arena);
+   request->shares_credentials = false;
 }
 
 kms_request_t *
@@ -61,39 +143,96 @@ kms_request_new (const char *method,
                  const char *path_and_query,
                  const kms_request_opt_t *opt)
 {
-   kms_request_t *request = calloc (1, sizeof (kms_request_t));
-   const char *question_mark;
+   kms_arena_t *arena = NULL;
+   kms_request_t *request;
 
-   /* parsing may set failed to true */
-   request->failed = false;
+   if (opt && opt->use_arena) {
+      arena = kms_arena_new (
+         opt->arena_block, opt->arena_block_size, opt->arena_chunk_size);
+   }
+
+   request = request_alloc (arena, false);
+   alloc_target (request);
+   alloc_credentials (request);
+   kms_request_reset (request, method, path_and_query, opt);
+
+   return request;
+}
+
+bool
+kms_request_reset (kms_request_t *request,
+                   const char *method,
+                   const char *path_and_query,
+                   const kms_request_opt_t *opt)
+{
+   const char *question_mark = strchr (path_and_query, '?');
+   bool was_failed = request->failed;
+   size_t path_len;
 
+   /* a clone stops borrowing from its prototype */
+   if (request->shares_target) {
+      alloc_target (request);
+   }
+
+   if (request->shares_credentials) {
+      alloc_credentials (request);
+   } else {
+      kms_request_str_set_chars (request->region, "", 0);
+      kms_request_str_set_chars (request->service, "", 0);
+      kms_request_str_set_chars (request->access_key_id, "", 0);
+      kms_request_str_set_chars (request->secret_key, "", 0);
+   }
+
+   request->proto_headers = NULL;
+   request->failed = false;
    request->finalized = false;
-   request->region = kms_request_str_new ();
-   request->service = kms_request_str_new ();
-   request->access_key_id = kms_request_str_new ();
-   request->secret_key = kms_request_str_new ();
-
-   question_mark = strchr (path_and_query, '?');
-   if (question_mark) {
-      request->path = kms_request_str_new_from_chars (
-         path_and_query, question_mark - path_and_query);
-      request->query = kms_request_str_new_from_chars (question_mark + 1, -1);
-      request->query_params = parse_query_params (request->query);
-      if (!request->query_params) {
+   kms_request_str_set_chars (request->method, method, -1);
+
+   /* keep the canonical path and parsed query if they're the same */
+   path_len = question_mark ? (size_t) (question_mark - path_and_query)
+                            : strlen (path_and_query);
+   if (path_len != request->path->len ||
+       0 != memcmp (request->path->str, path_and_query, path_len)) {
+      kms_request_str_set_chars (
+         request->path, path_and_query, (ssize_t) path_len);
+      request->canonical_path_valid = false;
+   }
+
+   if (!question_mark) {
+      kms_request_str_set_chars (request->query, "", 0);
+      kms_kv_list_clear (request->query_params);
+   } else if (was_failed || !request->query->len ||
+              0 != strcmp (request->query->str, question_mark + 1)) {
+      kms_request_str_set_chars (request->query, question_mark + 1, -1);
+      kms_kv_list_clear (request->query_params);
+      request->query_sorted = false;
+      if (!parse_query_params (request->query, request->query_params)) {
          KMS_ERROR (request, "Cannot parse query: %s", request->query->str);
       }
-   } else {
-      request->path = kms_request_str_new_from_chars (path_and_query, -1);
-      request->query = kms_request_str_new ();
-      request->query_params = kms_kv_list_new ();
    }
 
-   request->payload = kms_request_str_new ();
-   request->date = kms_request_str_new ();
-   request->datetime = kms_request_str_new ();
-   request->method = kms_request_str_new_from_chars (method, -1);
-   request->header_fields = kms_kv_list_new ();
+   kms_request_str_set_chars (request->payload, "", 0);
+   request->payload_ref = NULL;
+   request->payload_ref_len = 0;
+   request->payload_hash_mode = PAYLOAD_HASH_COMPUTED;
+   request->payload_hash_valid = false;
+   if (request->payload_hash_ctx) {
+      request->payload_hash_ctx =
+         kms_sha256_ctx_reset (request->payload_hash_ctx);
+   }
+
+   request->content_sha256 = opt && opt->content_sha256;
+   request->decoded_len = 0;
+   request->chunk_size = 0;
+   request->chunked_len = 0;
+   request->chunk_seeded = false;
+   kms_hmac_sha256_key_cleanup (&request->chunk_hmac);
+   kms_header_list_clear (request->header_fields);
+   request->signer = NULL;
+   request->has_signing_key = false;
+   request->signing_key_rescoped = false;
    request->auto_content_length = true;
+   invalidate (request);
 
    kms_request_set_date (request, NULL);
 
@@ -101,25 +240,42 @@ kms_request_new (const char *method,
       kms_request_add_header_field (request, "Connection", "close");
    }
 
-   return request;
+   return !request->failed;
 }
 
 void
 kms_request_destroy (kms_request_t *request)
 {
-   kms_request_str_destroy (request->region);
-   kms_request_str_destroy (request->service);
-   kms_request_str_destroy (request->access_key_id);
-   kms_request_str_destroy (request->secret_key);
-   kms_request_str_destroy (request->method);
-   kms_request_str_destroy (request->path);
-   kms_request_str_destroy (request->query);
+   kms_arena_t *arena = request->arena;
+
+   if (!request->shares_credentials) {
+      kms_request_str_destroy (request->region);
+      kms_request_str_destroy (request->service);
+      kms_request_str_destroy (request->access_key_id);
+      kms_request_str_destroy (request->secret_key);
+   }
+
+   if (!request->shares_target) {
+      kms_request_str_destroy (request->method);
+      kms_request_str_destroy (request->path);
+      kms_request_str_destroy (request->query);
+      kms_kv_list_destroy (request->query_params);
+      kms_request_str_destroy (request->canonical_path);
+   }
+
    kms_request_str_destroy (request->payload);
+   kms_sha256_ctx_destroy (request->payload_hash_ctx);
+   kms_hmac_sha256_key_cleanup (&request->chunk_hmac);
    kms_request_str_destroy (request->datetime);
    kms_request_str_destroy (request->date);
-   kms_kv_list_destroy (request->query_params);
-   kms_kv_list_destroy (request->header_fields);
-   free (request);
+   kms_header_list_destroy (request->header_fields);
+   kms_request_str_destroy (request->signed_headers);
+   kms_request_str_destroy (request->canonical);
+   kms_request_str_destroy (request->string_to_sign);
+   kms_request_str_destroy (request->authorization);
+   kms_request_str_destroy (request->signed_head);
+   kms_arena_free (arena, request);
+   kms_arena_destroy (arena);
 }
 
 const char *
@@ -134,7 +290,6 @@ bool
 kms_request_set_date (kms_request_t *request, const struct tm *tm)
 {
    char buf[sizeof AMZ_DT_FORMAT];
-   struct tm tmp_tm;
 
    if (request->failed) {
       return false;
@@ -142,20 +297,25 @@ kms_request_set_date (kms_request_t *request, const struct tm *tm)
 
    if (!tm) {
       /* use current time */
-      time_t t;
-      time (&t);
-      gmtime_r (&t, &tmp_tm);
-      tm = &tmp_tm;
-   }
-
-   if (0 == strftime (buf, sizeof AMZ_DT_FORMAT, "%Y%m%dT%H%M%SZ", tm)) {
+      if (!kms_clock_format_now (buf)) {
+         KMS_ERROR (request, "Could not format the current time");
+         return false;
+      }
+   } else if (0 == strftime (
+                      buf, sizeof AMZ_DT_FORMAT, "%Y%m%dT%H%M%SZ", tm)) {
       KMS_ERROR (request, "Invalid tm struct");
       return false;
    }
 
    kms_request_str_set_chars (request->date, buf, sizeof "YYYYmmDD" - 1);
    kms_request_str_set_chars (request->datetime, buf, sizeof AMZ_DT_FORMAT - 1);
-   kms_kv_list_del (request->header_fields, "X-Amz-Date");
+   if (kms_header_list_replace_value (
+          request->header_fields, "X-Amz-Date", buf)) {
+      invalidate_date (request);
+      return true;
+   }
+
+   kms_header_list_del (request->header_fields, "X-Amz-Date");
    kms_request_add_header_field (request, "X-Amz-Date", buf);
 
    return true;
@@ -163,31 +323,127 @@ kms_request_set_date (kms_request_t *request, const struct tm *tm)
 
 #undef AMZ_DT_FORMAT
 
+/* copy the credentials a clone borrowed from its prototype before changing
+ * them */
+static void
+own_credentials (kms_request_t *request)
+{
+   if (!request->shares_credentials) {
+      return;
+   }
+
+   request->region = kms_request_str_dup (request->region);
+   request->service = kms_request_str_dup (request->service);
+   request->access_key_id = kms_request_str_dup (request->access_key_id);
+   request->secret_key = kms_request_str_dup (request->secret_key);
+   request->shares_credentials = false;
+}
+
 bool
 kms_request_set_region (kms_request_t *request, const char *region)
 {
+   if (request->has_signing_key && 0 != strcmp (request->region->str, region)) {
+      request->signing_key_rescoped = true;
+   }
+
+   own_credentials (request);
    kms_request_str_set_chars (request->region, region, -1);
+   request->signer = NULL;
+   invalidate_signature (request);
    return true;
 }
 
 bool
 kms_request_set_service (kms_request_t *request, const char *service)
 {
+   if (request->has_signing_key &&
+       0 != strcmp (request->service->str, service)) {
+      request->signing_key_rescoped = true;
+   }
+
+   own_credentials (request);
    kms_request_str_set_chars (request->service, service, -1);
+   request->signer = NULL;
+   invalidate_signature (request);
    return true;
 }
 
 bool
 kms_request_set_access_key_id (kms_request_t *request, const char *akid)
 {
+   own_credentials (request);
    kms_request_str_set_chars (request->access_key_id, akid, -1);
+   request->signer = NULL;
+   invalidate_signature (request);
    return true;
 }
 
 bool
 kms_request_set_secret_key (kms_request_t *request, const char *key)
 {
+   own_credentials (request);
    kms_request_str_set_chars (request->secret_key, key, -1);
+   request->signer = NULL;
+   invalidate_signature (request);
+   request->has_signing_key = false;
+   return true;
+}
+
+bool
+kms_request_set_signing_key (kms_request_t *request,
+                             const unsigned char *key,
+                             const char *date)
+{
+   CHECK_FAILED;
+
+   if (strlen (date) != sizeof request->signing_key_date - 1) {
+      KMS_ERROR (request, "Signing key date must be like YYYYmmDD: %s", date);
+      return false;
+   }
+
+   if (0 != strcmp (date, request->date->str)) {
+      KMS_ERROR (request,
+                 "Signing key is for %s, request date is %s",
+                 date,
+                 request->date->str);
+      return false;
+   }
+
+   memcpy (request->signing_key, key, sizeof (request->signing_key));
+   memcpy (request->signing_key_date, date, sizeof request->signing_key_date);
+   request->has_signing_key = true;
+   request->signing_key_rescoped = false;
+   request->signer = NULL;
+   invalidate_signature (request);
+   return true;
+}
+
+bool
+kms_request_set_signer (kms_request_t *request, kms_signer_t *signer)
+{
+   CHECK_FAILED;
+
+   if (!signer) {
+      KMS_ERROR (request, "Signer must not be NULL");
+      return false;
+   }
+
+   /* a clone given its own signer for its thread keeps borrowing its
+    * prototype's credentials if they're the same */
+   if (!request->shares_credentials ||
+       0 != strcmp (request->region->str, signer->region->str) ||
+       0 != strcmp (request->service->str, signer->service->str) ||
+       0 != strcmp (request->access_key_id->str, signer->access_key_id->str)) {
+      own_credentials (request);
+      kms_request_str_set_chars (request->region, signer->region->str, -1);
+      kms_request_str_set_chars (request->service, signer->service->str, -1);
+      kms_request_str_set_chars (
+         request->access_key_id, signer->access_key_id->str, -1);
+   }
+
+   request->signer = signer;
+   request->has_signing_key = false;
+   invalidate_signature (request);
    return true;
 }
 
@@ -196,15 +452,10 @@ kms_request_add_header_field (kms_request_t *request,
                               const char *field_name,
                               const char *value)
 {
-   kms_request_str_t *k, *v;
-
    CHECK_FAILED;
 
-   k = kms_request_str_new_from_chars (field_name, -1);
-   v = kms_request_str_new_from_chars (value, -1);
-   kms_kv_list_add (request->header_fields, k, v);
-   kms_request_str_destroy (k);
-   kms_request_str_destroy (v);
+   kms_header_list_add (request->header_fields, field_name, value);
+   invalidate (request);
 
    return true;
 }
@@ -214,477 +465,1862 @@ kms_request_append_header_field_value (kms_request_t *request,
                                        const char *value,
                                        size_t len)
 {
-   kms_request_str_t *v;
-
    CHECK_FAILED;
 
-   if (request->header_fields->len == 0) {
+   if (!kms_header_list_append_value (request->header_fields, value, len)) {
       KMS_ERROR (
          request,
          "Ensure the request has at least one header field before calling %s",
          __FUNCTION__);
+      return false;
    }
 
-   v = request->header_fields->kvs[request->header_fields->len - 1].value;
-   kms_request_str_append_chars (v, value, len);
+   invalidate (request);
 
    return true;
 }
 
-bool
-kms_request_append_payload (kms_request_t *request,
-                            const char *payload,
-                            size_t len)
+static size_t
+payload_len (const kms_request_t *request)
 {
-   CHECK_FAILED;
+   return request->payload_ref ? request->payload_ref_len
+                               : request->payload->len;
+}
 
-   kms_request_str_append_chars (request->payload, payload, len);
+static const char *
+payload_chars (const kms_request_t *request)
+{
+   return request->payload_ref ? request->payload_ref : request->payload->str;
+}
+
+/* checks that "request" can take more payload, and hashes it */
+static bool
+add_payload (kms_request_t *request, const char *payload, size_t len)
+{
+   if (request->payload_hash_mode == PAYLOAD_STREAMING) {
+      KMS_ERROR (request,
+                 "Send a streaming payload with kms_request_sign_chunk");
+      return false;
+   }
+
+   if (request->payload_ref) {
+      KMS_ERROR (request, "Cannot add to a borrowed payload");
+      return false;
+   }
+
+   invalidate (request);
+   if (request->payload_hash_mode != PAYLOAD_HASH_COMPUTED) {
+      return true;
+   }
+
+   if (!request->payload_hash_ctx) {
+      request->payload_hash_ctx = kms_sha256_ctx_new_in (request->arena);
+   }
+
+   /* hash as we go, so canonicalization never rereads the payload */
+   if (!request->payload_hash_ctx ||
+       !kms_sha256_ctx_update (request->payload_hash_ctx, payload, len)) {
+      KMS_ERROR (request, "Could not hash payload");
+      return false;
+   }
 
+   request->payload_hash_valid = false;
    return true;
 }
 
-/* docs.aws.amazon.com/general/latest/gr/sigv4-create-canonical-request.html
- *
- * "Sort the parameter names by character code point in ascending order. For
- * example, a parameter name that begins with the uppercase letter F precedes a
- * parameter name that begins with a lowercase letter b."
- */
-static int
-cmp_query_params (const void *a, const void *b)
+bool
+kms_request_append_payload (kms_request_t *request,
+                            const char *payload,
+                            size_t len)
 {
-   int r = strcmp (((kms_kv_t *) a)->key->str, ((kms_kv_t *) b)->key->str);
-   if (r != 0) {
-      return r;
+   CHECK_FAILED;
+
+   if (!add_payload (request, payload, len)) {
+      return false;
    }
 
-   /* not in docs, but tested in get-vanilla-query-order-key: sort by value */
-   return strcmp (((kms_kv_t *) a)->value->str, ((kms_kv_t *) b)->value->str);
+   kms_request_str_append_chars (request->payload, payload, len);
+   return true;
 }
 
-static void
-append_canonical_query (kms_request_t *request, kms_request_str_t *str)
+bool
+kms_request_set_payload_ref (kms_request_t *request,
+                             const char *payload,
+                             size_t len)
 {
-   size_t i;
-   kms_kv_list_t *lst;
+   CHECK_FAILED;
 
-   if (!request->query_params->len) {
-      return;
+   if (request->payload->len) {
+      KMS_ERROR (request, "Cannot borrow a payload after appending one");
+      return false;
    }
 
-   lst = kms_kv_list_dup (request->query_params);
-   kms_kv_list_sort (lst, cmp_query_params);
-
-   for (i = 0; i < lst->len; i++) {
-      kms_request_str_append_escaped (str, lst->kvs[i].key, true);
-      kms_request_str_append_char (str, '=');
-      kms_request_str_append_escaped (str, lst->kvs[i].value, true);
+   if (!len) {
+      return true;
+   }
 
-      if (i < lst->len - 1) {
-         kms_request_str_append_char (str, '&');
-      }
+   if (!add_payload (request, payload, len)) {
+      return false;
    }
 
-   kms_kv_list_destroy (lst);
+   request->payload_ref = payload;
+   request->payload_ref_len = len;
+   return true;
 }
 
-/* "lst" is a sorted list of headers */
-static void
-append_canonical_headers (kms_kv_list_t *lst, kms_request_str_t *str)
+bool
+kms_request_append_payload_b64 (kms_request_t *request,
+                                const uint8_t *data,
+                                size_t len)
 {
-   size_t i;
-   kms_kv_t *kv;
-   const kms_request_str_t *previous_key = NULL;
-
-   /* aws docs: "To create the canonical headers list, convert all header names
-    * to lowercase and remove leading spaces and trailing spaces. Convert
-    * sequential spaces in the header value to a single space." "Do not sort the
-    * values in headers that have multiple values." */
-   for (i = 0; i < lst->len; i++) {
-      kv = &lst->kvs[i];
-      if (previous_key && 0 == strcasecmp (previous_key->str, kv->key->str)) {
-         /* duplicate header */
-         kms_request_str_append_char (str, ',');
-         kms_request_str_append_stripped (str, kv->value);
-         continue;
+   /* 192 bytes encode to 256 characters, plus the terminator */
+   char b64[257];
+   size_t n;
+   int b64_len;
+
+   while (len) {
+      n = len < 192 ? len : 192;
+      b64_len = kms_message_b64_ntop (data, n, b64, sizeof b64);
+      if (b64_len == -1) {
+         KMS_ERROR (request, "Could not base64-encode payload");
+         return false;
       }
 
-      if (i > 0) {
-         kms_request_str_append_newline (str);
+      if (!kms_request_append_payload (request, b64, (size_t) b64_len)) {
+         return false;
       }
 
-      kms_request_str_append_lowercase (str, kv->key);
-      kms_request_str_append_char (str, ':');
-      kms_request_str_append_stripped (str, kv->value);
-      previous_key = kv->key;
+      data += n;
+      len -= n;
    }
 
-   kms_request_str_append_newline (str);
+   return true;
 }
 
-static void
-append_signed_headers (kms_kv_list_t *lst, kms_request_str_t *str)
+bool
+kms_request_set_payload_hash (kms_request_t *request,
+                              const unsigned char *hash)
 {
-   size_t i;
+   CHECK_FAILED;
 
-   kms_kv_t *kv;
-   const kms_request_str_t *previous_key = NULL;
+   memcpy (request->payload_hash, hash, sizeof (request->payload_hash));
+   request->payload_hash_valid = true;
+   request->payload_hash_mode = PAYLOAD_HASH_SUPPLIED;
+   kms_sha256_ctx_destroy (request->payload_hash_ctx);
+   request->payload_hash_ctx = NULL;
+   invalidate (request);
 
-   for (i = 0; i < lst->len; i++) {
-      kv = &lst->kvs[i];
-      if (previous_key && 0 == strcasecmp (previous_key->str, kv->key->str)) {
-         /* duplicate header */
-         continue;
-      }
+   return true;
+}
 
-      if (0 == strcasecmp (kv->key->str, "connection")) {
-         continue;
-      }
+static int
+hex_digit (char c)
+{
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
 
-      kms_request_str_append_lowercase (str, kv->key);
-      if (i < lst->len - 1) {
-         kms_request_str_append_char (str, ';');
-      }
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
 
-      previous_key = kv->key;
+   if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
    }
+
+   return -1;
 }
 
-static bool
-finalize (kms_request_t *request)
+bool
+kms_request_set_payload_hash_hex (kms_request_t *request, const char *hex)
 {
-   kms_kv_list_t *lst;
-   kms_request_str_t *k;
-   kms_request_str_t *v;
+   unsigned char hash[32];
+   int hi, lo;
+   size_t i;
 
-   if (request->failed) {
+   CHECK_FAILED;
+
+   if (strlen (hex) != 2 * sizeof (hash)) {
+      KMS_ERROR (request, "Payload hash must be 64 hex digits: %s", hex);
       return false;
    }
 
-   if (request->finalized) {
-      return true;
-   }
+   for (i = 0; i < sizeof (hash); i++) {
+      hi = hex_digit (hex[2 * i]);
+      lo = hex_digit (hex[2 * i + 1]);
+      if (hi < 0 || lo < 0) {
+         KMS_ERROR (request, "Payload hash must be 64 hex digits: %s", hex);
+         return false;
+      }
 
-   request->finalized = true;
+      hash[i] = (unsigned char) (hi << 4 | lo);
+   }
 
-   lst = request->header_fields;
+   return kms_request_set_payload_hash (request, hash);
+}
 
-   if (!kms_kv_list_find (lst, "Host")) {
-      /* like "kms.us-east-1.amazonaws.com" */
-      k = kms_request_str_new_from_chars ("Host", -1);
-      v = kms_request_str_dup (request->service);
-      kms_request_str_append_char (v, '.');
-      kms_request_str_append (v, request->region);
-      kms_request_str_append_chars (v, ".amazonaws.com", -1);
-      kms_kv_list_add (lst, k, v);
-      kms_request_str_destroy (k);
-      kms_request_str_destroy (v);
-   }
+bool
+kms_request_set_unsigned_payload (kms_request_t *request)
+{
+   CHECK_FAILED;
 
-   if (!kms_kv_list_find (lst, "Content-Length") && request->payload->len &&
-       request->auto_content_length) {
-      k = kms_request_str_new_from_chars ("Content-Length", -1);
-      v = kms_request_str_new ();
-      kms_request_str_appendf (v, "%zu", request->payload->len);
-      kms_kv_list_add (lst, k, v);
-      kms_request_str_destroy (k);
-      kms_request_str_destroy (v);
-   }
+   request->payload_hash_valid = false;
+   request->payload_hash_mode = PAYLOAD_UNSIGNED;
+   kms_sha256_ctx_destroy (request->payload_hash_ctx);
+   request->payload_hash_ctx = NULL;
+   invalidate (request);
 
    return true;
 }
 
-/* docs.aws.amazon.com/general/latest/gr/sigv4-create-canonical-request.html
- *
- * "Build the canonical headers list by sorting the (lowercase) headers by
- * character code... Do not sort the values in headers that have multiple
- * values."
- */
-static int
-cmp_header_field_names (const void *a, const void *b)
+/* like "400;chunk-signature=<64 hex digits>\r\n<data>\r\n" */
+static size_t
+framed_chunk_len (size_t len)
 {
-   return strcasecmp (((kms_kv_t *) a)->key->str, ((kms_kv_t *) b)->key->str);
-}
+   size_t digits = 1;
+   size_t n;
 
-static kms_kv_list_t *
-canonical_headers (const kms_request_t *request)
-{
-   kms_kv_list_t *lst;
+   for (n = len; n >= 16; n /= 16) {
+      digits++;
+   }
 
-   assert (request->finalized);
-   lst = kms_kv_list_dup (request->header_fields);
-   kms_kv_list_sort (lst, cmp_header_field_names);
-   kms_kv_list_del (lst, "Connection");
-   return lst;
+   return digits + sizeof ";chunk-signature=" - 1 + 64 + 2 + len + 2;
 }
 
-char *
-kms_request_get_canonical (kms_request_t *request)
+bool
+kms_request_set_streaming_payload (kms_request_t *request,
+                                   size_t decoded_len,
+                                   size_t chunk_size)
 {
-   kms_request_str_t *canonical;
-   kms_request_str_t *normalized;
-   kms_kv_list_t *lst;
+   CHECK_FAILED;
 
-   if (request->failed) {
-      return NULL;
+   if (!chunk_size) {
+      KMS_ERROR (request, "Chunk size must be positive");
+      return false;
    }
 
-   if (!finalize (request)) {
-      return NULL;
+   if (payload_len (request)) {
+      KMS_ERROR (request, "Cannot stream a request that has a payload");
+      return false;
    }
 
-   canonical = kms_request_str_new ();
-   kms_request_str_append (canonical, request->method);
-   kms_request_str_append_newline (canonical);
-   normalized = kms_request_str_path_normalized (request->path);
-   kms_request_str_append_escaped (canonical, normalized, false);
-   kms_request_str_append_newline (canonical);
-   append_canonical_query (request, canonical);
-   kms_request_str_append_newline (canonical);
-   lst = canonical_headers (request);
-   append_canonical_headers (lst, canonical);
-   kms_request_str_append_newline (canonical);
-   append_signed_headers (lst, canonical);
-   kms_request_str_append_newline (canonical);
-   kms_request_str_append_hashed (canonical, request->payload);
-
-   kms_request_str_destroy (normalized);
-   kms_kv_list_destroy (lst);
+   request->payload_hash_valid = false;
+   request->payload_hash_mode = PAYLOAD_STREAMING;
+   kms_sha256_ctx_destroy (request->payload_hash_ctx);
+   request->payload_hash_ctx = NULL;
+   request->decoded_len = decoded_len;
+   request->chunk_size = chunk_size;
+   request->chunked_len = 0;
+   request->chunk_seeded = false;
+   invalidate (request);
 
-   return kms_request_str_detach (canonical);
+   return true;
 }
 
-char *
-kms_request_get_string_to_sign (kms_request_t *request)
+static bool
+append_payload_hash (kms_request_t *request, kms_request_sink_t *sink)
 {
-   bool success = false;
-   kms_request_str_t *sts;
-   kms_request_str_t *creq = NULL; /* canonical request */
-
+   if (request->payload_hash_mode == PAYLOAD_UNSIGNED) {
+      kms_request_sink_append_chars (sink, "UNSIGNED-PAYLOAD", -1);
+      return true;
+   }
+
+   if (request->payload_hash_mode == PAYLOAD_STREAMING) {
+      kms_request_sink_append_chars (sink, STREAMING_PAYLOAD, -1);
+      return true;
+   }
+
+   if (request->payload_hash_mode == PAYLOAD_HASH_COMPUTED &&
+       !request->payload_hash_ctx) {
+      kms_request_sink_append_chars (sink, EMPTY_HASH, -1);
+      return true;
+   }
+
+   if (!request->payload_hash_valid) {
+      if (!kms_sha256_ctx_digest (request->payload_hash_ctx,
+                                  request->payload_hash)) {
+         return false;
+      }
+
+      request->payload_hash_valid = true;
+   }
+
+   kms_request_sink_append_hex (
+      sink, request->payload_hash, sizeof (request->payload_hash));
+   return true;
+}
+
+/* docs.aws.amazon.com/general/latest/gr/sigv4-create-canonical-request.html
+ *
+ * "Sort the parameter names by character code point in ascending order. For
+ * example, a parameter name that begins with the uppercase letter F precedes a
+ * parameter name that begins with a lowercase letter b."
+ */
+static int
+cmp_query_params (const void *a, const void *b)
+{
+   int r = strcmp (((kms_kv_t *) a)->key->str, ((kms_kv_t *) b)->key->str);
+   if (r != 0) {
+      return r;
+   }
+
+   /* not in docs, but tested in get-vanilla-query-order-key: sort by value */
+   return strcmp (((kms_kv_t *) a)->value->str, ((kms_kv_t *) b)->value->str);
+}
+
+static void
+append_canonical_query (kms_request_t *request, kms_request_sink_t *sink)
+{
+   size_t i;
+   kms_kv_list_t *lst = request->query_params;
+
+   if (!lst->len) {
+      return;
+   }
+
+   /* the query string is kept for the request line, the parsed parameters are
+    * only for signing, so sort them in place. A prototype's are sorted before
+    * it's shared. */
+   if (!request->query_sorted) {
+      kms_kv_list_sort (lst, cmp_query_params);
+      request->query_sorted = true;
+   }
+
+   for (i = 0; i < lst->len; i++) {
+      kms_request_sink_append_escaped (sink, lst->kvs[i].key, true);
+      kms_request_sink_append_char (sink, '=');
+      kms_request_sink_append_escaped (sink, lst->kvs[i].value, true);
+
+      if (i < lst->len - 1) {
+         kms_request_sink_append_char (sink, '&');
+      }
+   }
+}
+
+/* docs.aws.amazon.com/general/latest/gr/sigv4-create-canonical-request.html
+ *
+ * "Build the canonical headers list by sorting the (lowercase) headers by
+ * character code... Do not sort the values in headers that have multiple
+ * values." kms_header_list_t keeps them that way.
+ */
+static void
+append_canonical_headers (kms_header_iter_t *iter, kms_request_sink_t *sink)
+{
+   const kms_header_t *header;
+   const kms_header_t *previous = NULL;
+
+   /* aws docs: "To create the canonical headers list, convert all header names
+    * to lowercase and remove leading spaces and trailing spaces. Convert
+    * sequential spaces in the header value to a single space." "Do not sort the
+    * values in headers that have multiple values." */
+   while ((header = kms_header_iter_next (iter))) {
+      if (header->id == KMS_HEADER_CONNECTION) {
+         /* not signed, see append_signed_headers */
+         continue;
+      }
+
+      if (previous && 0 == kms_header_cmp (previous, header)) {
+         /* duplicate header */
+         kms_request_sink_append_char (sink, ',');
+         kms_request_sink_append (sink, header->stripped_value);
+         continue;
+      }
+
+      if (previous) {
+         kms_request_sink_append_char (sink, '\n');
+      }
+
+      kms_request_sink_append (sink, header->lower_key);
+      kms_request_sink_append_char (sink, ':');
+      kms_request_sink_append (sink, header->stripped_value);
+      previous = header;
+   }
+
+   kms_request_sink_append_char (sink, '\n');
+}
+
+static void
+append_signed_headers (kms_header_iter_t *iter, kms_request_sink_t *sink)
+{
+   const kms_header_t *header;
+   const kms_header_t *previous = NULL;
+
+   while ((header = kms_header_iter_next (iter))) {
+      if (previous && 0 == kms_header_cmp (previous, header)) {
+         /* duplicate header */
+         continue;
+      }
+
+      if (header->id == KMS_HEADER_CONNECTION) {
+         continue;
+      }
+
+      if (previous) {
+         kms_request_sink_append_char (sink, ';');
+      }
+
+      kms_request_sink_append (sink, header->lower_key);
+      previous = header;
+   }
+}
+
+static bool
+has_header (const kms_request_t *request, const char *key)
+{
+   return kms_header_list_find (request->header_fields, key) ||
+          (request->proto_headers &&
+           kms_header_list_find (request->proto_headers, key));
+}
+
+/* a copy of a request's headers, with its prototype's */
+static kms_header_list_t *
+all_headers (const kms_request_t *request)
+{
+   kms_header_list_t *lst;
+   const kms_header_t *header;
+   size_t i;
+
+   if (!request->proto_headers) {
+      return kms_header_list_dup (request->header_fields);
+   }
+
+   lst = kms_header_list_dup (request->proto_headers);
+   for (i = 0; i < request->header_fields->len; i++) {
+      header = &request->header_fields->headers[i];
+      kms_header_list_add_chars (lst,
+                                 header->key->str,
+                                 header->key->len,
+                                 header->value->str,
+                                 header->value->len);
+   }
+
+   return lst;
+}
+
+/* built in place, so a reset request reuses the header's memory */
+static void
+add_host (const kms_request_t *request, kms_header_list_t *lst)
+{
+   /* like "kms.us-east-1.amazonaws.com" */
+   kms_header_list_add (lst, "Host", request->service->str);
+   kms_header_list_append_value (lst, ".", 1);
+   kms_header_list_append_value (
+      lst, request->region->str, request->region->len);
+   kms_header_list_append_value (
+      lst, ".amazonaws.com", sizeof ".amazonaws.com" - 1);
+}
+
+static void
+add_size_header (kms_header_list_t *lst, const char *key, size_t size)
+{
+   char buf[sizeof "18446744073709551615"];
+   int len = sprintf (buf, "%zu", size);
+
+   kms_header_list_add_chars (lst, key, strlen (key), buf, (size_t) len);
+}
+
+static bool
+finalize (kms_request_t *request)
+{
+   kms_header_list_t *lst;
+   kms_request_str_t *v;
+   kms_request_sink_t sink;
+   size_t len;
+
+   if (request->failed) {
+      return false;
+   }
+
+   if (request->finalized) {
+      return true;
+   }
+
+   request->finalized = true;
+
+   lst = request->header_fields;
+
+   if (!has_header (request, "Host")) {
+      add_host (request, lst);
+   }
+
+   if (!has_header (request, "Content-Length") && payload_len (request) &&
+       request->auto_content_length) {
+      add_size_header (lst, "Content-Length", payload_len (request));
+   }
+
+   if (request->payload_hash_mode == PAYLOAD_STREAMING &&
+       !has_header (request, "Content-Encoding")) {
+      kms_header_list_add (lst, "Content-Encoding", "aws-chunked");
+   }
+
+   if (request->payload_hash_mode == PAYLOAD_STREAMING &&
+       !has_header (request, "Content-Length")) {
+      /* whole chunks, maybe a shorter one, then the empty final chunk */
+      len = request->decoded_len / request->chunk_size *
+               framed_chunk_len (request->chunk_size) +
+            framed_chunk_len (0);
+      if (request->decoded_len % request->chunk_size) {
+         len +=
+            framed_chunk_len (request->decoded_len % request->chunk_size);
+      }
+
+      add_size_header (lst, "Content-Length", len);
+   }
+
+   if (request->payload_hash_mode == PAYLOAD_STREAMING &&
+       !has_header (request, "X-Amz-Decoded-Content-Length")) {
+      add_size_header (
+         lst, "X-Amz-Decoded-Content-Length", request->decoded_len);
+   }
+
+   if ((request->content_sha256 ||
+        request->payload_hash_mode == PAYLOAD_STREAMING) &&
+       !has_header (request, "X-Amz-Content-Sha256")) {
+      v = kms_request_str_new ();
+      kms_request_sink_init_str (&sink, v);
+      if (!append_payload_hash (request, &sink) ||
+          !kms_request_sink_flush (&sink)) {
+         KMS_ERROR (request, "Could not hash payload");
+      } else {
+         kms_header_list_add (lst, "X-Amz-Content-Sha256", v->str);
+      }
+
+      kms_request_str_destroy (v);
+      return !request->failed;
+   }
+
+   return true;
+}
+
+/* a malloc'd copy of the memoized "str", for the getters' callers */
+static char *
+copy_str (const kms_request_str_t *str)
+{
+   char *copy = kms_malloc (str->len + 1);
+
+   memcpy (copy, str->str, str->len + 1);
+   return copy;
+}
+
+/* append like "/foo/bar%20baz" from "/foo/../foo/bar baz" */
+static void
+append_canonical_path (kms_request_str_t *str, kms_request_str_t *path)
+{
+   kms_request_str_t *normalized;
+
+   normalized = kms_request_str_path_normalized (path);
+   kms_request_str_append_escaped (str, normalized, false);
+   kms_request_str_destroy (normalized);
+}
+
+/* list the signed headers, unless they're still valid from the last call */
+static bool
+prepare_canonical (kms_request_t *request)
+{
+   kms_request_sink_t sink;
+   kms_header_iter_t iter;
+
+   if (!finalize (request)) {
+      return false;
+   }
+
+   if (request->canonical_valid) {
+      return true;
+   }
+
+   /* the path only changes in kms_request_reset */
+   if (!request->canonical_path_valid) {
+      if (request->canonical_path) {
+         kms_request_str_set_chars (request->canonical_path, "", 0);
+      } else {
+         request->canonical_path = kms_request_str_new_in (request->arena);
+      }
+
+      append_canonical_path (request->canonical_path, request->path);
+      request->canonical_path_valid = true;
+   }
+
+   kms_request_str_set_chars (request->signed_headers, "", 0);
+   kms_request_sink_init_str (&sink, request->signed_headers);
+   kms_header_iter_init (&iter, request->proto_headers, request->header_fields);
+   append_signed_headers (&iter, &sink);
+   kms_request_sink_flush (&sink);
+
+   request->canonical_valid = true;
+   return true;
+}
+
+static bool
+write_canonical (kms_request_t *request, kms_request_sink_t *sink)
+{
+   kms_header_iter_t iter;
+
+   kms_request_sink_append (sink, request->method);
+   kms_request_sink_append_char (sink, '\n');
+   kms_request_sink_append (sink, request->canonical_path);
+   kms_request_sink_append_char (sink, '\n');
+   append_canonical_query (request, sink);
+   kms_request_sink_append_char (sink, '\n');
+   kms_header_iter_init (&iter, request->proto_headers, request->header_fields);
+   append_canonical_headers (&iter, sink);
+   kms_request_sink_append_char (sink, '\n');
+   kms_request_sink_append (sink, request->signed_headers);
+   kms_request_sink_append_char (sink, '\n');
+   if (!append_payload_hash (request, sink)) {
+      KMS_ERROR (request, "Could not hash payload");
+      return false;
+   }
+
+   return true;
+}
+
+/* the canonical request as a string, for kms_request_get_canonical and for
+ * hashing several at once in kms_request_sign_batch */
+static bool
+build_canonical_str (kms_request_t *request)
+{
+   kms_request_sink_t sink;
+
+   if (!prepare_canonical (request)) {
+      return false;
+   }
+
+   if (request->canonical_str_valid) {
+      return true;
+   }
+
+   kms_request_str_set_chars (request->canonical, "", 0);
+   kms_request_sink_init_str (&sink, request->canonical);
+   if (!write_canonical (request, &sink)) {
+      return false;
+   }
+
+   kms_request_sink_flush (&sink);
+   request->canonical_str_valid = true;
+   return true;
+}
+
+/* hash the canonical request as it's written, without storing it */
+static bool
+build_canonical_hash (kms_request_t *request)
+{
+   kms_request_sink_t sink;
+
+   if (!prepare_canonical (request)) {
+      return false;
+   }
+
+   if (request->canonical_hash_valid) {
+      return true;
+   }
+
+   if (!kms_request_sink_init_sha256 (&sink)) {
+      KMS_ERROR (request, "Could not hash canonical request");
+      return false;
+   }
+
+   if (!write_canonical (request, &sink)) {
+      kms_request_sink_cleanup (&sink);
+      return false;
+   }
+
+   if (!kms_request_sink_final (&sink, request->canonical_hash)) {
+      KMS_ERROR (request, "Could not hash canonical request");
+      return false;
+   }
+
+   request->canonical_hash_valid = true;
+   return true;
+}
+
+char *
+kms_request_get_canonical (kms_request_t *request)
+{
+   if (request->failed) {
+      return NULL;
+   }
+
+   if (!build_canonical_str (request)) {
+      return NULL;
+   }
+
+   return copy_str (request->canonical);
+}
+
+/* like "AWS4-HMAC-SHA256\n20150830T123600Z\n20150830/us-east-1/...\n", the
+ * string to sign up to the hash of the canonical request */
+static bool
+append_string_to_sign_prefix (kms_request_t *request,
+                              const char *algorithm,
+                              kms_request_str_t *sts)
+{
+   const kms_signer_slot_t *slot;
+
+   kms_request_str_append_chars (sts, algorithm, -1);
+   kms_request_str_append_newline (sts);
+   kms_request_str_append (sts, request->datetime);
+   kms_request_str_append_newline (sts);
+
+   /* credential scope, like "20150830/us-east-1/service/aws4_request" */
+   if (request->signer) {
+      slot = kms_signer_get_slot (
+         request->signer, request->date, request->datetime);
+      if (!slot) {
+         KMS_ERROR (request, "Could not derive signing key");
+         return false;
+      }
+
+      kms_request_str_append (sts, slot->scope);
+      kms_request_str_append_newline (sts);
+   } else {
+      kms_request_str_append (sts, request->date);
+      kms_request_str_append_char (sts, '/');
+      kms_request_str_append (sts, request->region);
+      kms_request_str_append_char (sts, '/');
+      kms_request_str_append (sts, request->service);
+      kms_request_str_append_chars (sts, "/aws4_request\n", -1);
+   }
+
+   return true;
+}
+
+static bool
+build_string_to_sign (kms_request_t *request)
+{
+   kms_request_str_t *sts = request->string_to_sign;
+
+   if (!build_canonical_hash (request)) {
+      return false;
+   }
+
+   if (request->sts_valid) {
+      return true;
+   }
+
+   kms_request_str_set_chars (sts, "", 0);
+   if (!append_string_to_sign_prefix (request, "AWS4-HMAC-SHA256", sts)) {
+      return false;
+   }
+
+   kms_request_str_append_hex (
+      sts, request->canonical_hash, sizeof (request->canonical_hash));
+   request->sts_valid = true;
+   return true;
+}
+
+char *
+kms_request_get_string_to_sign (kms_request_t *request)
+{
+   if (request->failed) {
+      return NULL;
+   }
+
+   if (!build_string_to_sign (request)) {
+      return NULL;
+   }
+
+   return copy_str (request->string_to_sign);
+}
+
+bool
+kms_request_get_signing_key (kms_request_t *request, unsigned char *key)
+{
+   const kms_signer_slot_t *slot;
+
+   if (request->failed) {
+      return false;
+   }
+
+   if (request->signer) {
+      slot = kms_signer_get_slot (
+         request->signer, request->date, request->datetime);
+      if (!slot) {
+         return false;
+      }
+
+      memcpy (key, slot->key, sizeof (slot->key));
+      return true;
+   }
+
+   if (request->has_signing_key) {
+      /* the date, region, or service may have changed since
+       * kms_request_set_signing_key */
+      if (request->signing_key_rescoped) {
+         KMS_ERROR (request,
+                    "Signing key is not for region %s and service %s",
+                    request->region->str,
+                    request->service->str);
+         return false;
+      }
+
+      if (0 != strcmp (request->signing_key_date, request->date->str)) {
+         KMS_ERROR (request,
+                    "Signing key is for %s, request date is %s",
+                    request->signing_key_date,
+                    request->date->str);
+         return false;
+      }
+
+      memcpy (key, request->signing_key, sizeof (request->signing_key));
+      return true;
+   }
+
+   return kms_derive_signing_key (request->secret_key,
+                                  request->date,
+                                  request->region,
+                                  request->service,
+                                  key);
+}
+
+/* store "signature" and the Authorization header value made from it, like
+ * "AWS4-HMAC-SHA256 Credential=.../aws4_request, SignedHeaders=...,
+ * Signature=..." */
+static bool
+set_signature (kms_request_t *request, const unsigned char *signature)
+{
+   kms_request_str_t *auth = request->authorization;
+   const kms_signer_slot_t *slot;
+
+   kms_request_str_set_chars (auth, "", 0);
+   if (request->signer) {
+      /* the string to sign already derived the key for this date */
+      slot = kms_signer_get_slot (
+         request->signer, request->date, request->datetime);
+      if (!slot) {
+         KMS_ERROR (request, "Could not derive signing key");
+         return false;
+      }
+
+      kms_request_str_append (auth, slot->credential);
+   } else {
+      kms_request_str_append_chars (auth, "AWS4-HMAC-SHA256 Credential=", -1);
+      kms_request_str_append (auth, request->access_key_id);
+      kms_request_str_append_char (auth, '/');
+      kms_request_str_append (auth, request->date);
+      kms_request_str_append_char (auth, '/');
+      kms_request_str_append (auth, request->region);
+      kms_request_str_append_char (auth, '/');
+      kms_request_str_append (auth, request->service);
+      kms_request_str_append_chars (auth, "/aws4_request", -1);
+   }
+
+   kms_request_str_append_chars (auth, ", SignedHeaders=", -1);
+   kms_request_str_append (auth, request->signed_headers);
+   kms_request_str_append_chars (auth, ", Signature=", -1);
+   kms_request_str_append_hex (auth, signature, 32);
+
+   memcpy (request->signature, signature, sizeof (request->signature));
+   request->signature_valid = true;
+   return true;
+}
+
+/* the request's signature is the seed of the chunk signatures */
+static bool
+seed_chunks (kms_request_t *request, const unsigned char *signature)
+{
+   unsigned char key[32];
+
+   kms_hmac_sha256_key_cleanup (&request->chunk_hmac);
+   if (!kms_request_get_signing_key (request, key) ||
+       !kms_hmac_sha256_key_init (&request->chunk_hmac, key, sizeof (key))) {
+      KMS_ERROR (request, "Could not derive signing key");
+      return false;
+   }
+
+   memcpy (request->chunk_signature, signature, 32);
+   request->chunked_len = 0;
+   request->chunk_seeded = true;
+   return true;
+}
+
+
+static bool
+build_signature (kms_request_t *request)
+{
+   kms_request_str_t *sts = request->string_to_sign;
+   const kms_signer_slot_t *slot;
+   unsigned char signing_key[32];
+   unsigned char signature[32];
+
+   if (!build_string_to_sign (request)) {
+      return false;
+   }
+
+   if (!request->signature_valid) {
+      if (request->signer) {
+         slot = kms_signer_get_slot (
+            request->signer, request->date, request->datetime);
+         if (!slot || !kms_hmac_sha256_keyed (
+                         &slot->hmac, sts->str, sts->len, signature)) {
+            return false;
+         }
+      } else if (!kms_request_get_signing_key (request, signing_key) ||
+                 !kms_sha256_hmac ((char *) signing_key,
+                                   sizeof (signing_key),
+                                   sts->str,
+                                   sts->len,
+                                   signature)) {
+         return false;
+      }
+
+      if (!set_signature (request, signature)) {
+         return false;
+      }
+
+      /* a new signature restarts the chain of chunk signatures */
+      request->chunk_seeded = false;
+   }
+
+   /* start a chain if there's none, but getters mustn't break one that's
+    * under way */
+   if (request->payload_hash_mode == PAYLOAD_STREAMING &&
+       !request->chunk_seeded && !seed_chunks (request, request->signature)) {
+      return false;
+   }
+
+   return true;
+}
+
+char *
+kms_request_get_signature (kms_request_t *request)
+{
+   if (request->failed) {
+      return NULL;
+   }
+
+   if (!build_signature (request)) {
+      return NULL;
+   }
+
+   return copy_str (request->authorization);
+}
+
+/* the request line, the headers, and the Authorization header's name, like
+ * "POST / HTTP/1.1\nHost:..." */
+static void
+build_signed_head (kms_request_t *request)
+{
+   kms_request_str_t *head = request->signed_head;
+   kms_header_iter_t iter;
+   const kms_header_t *header;
+
+   if (request->signed_head_valid) {
+      return;
+   }
+
+   kms_request_str_set_chars (head, "", 0);
+   kms_request_str_append (head, request->method);
+   kms_request_str_append_char (head, ' ');
+   kms_request_str_append (head, request->path);
+   if (request->query->len) {
+      kms_request_str_append_char (head, '?');
+      kms_request_str_append (head, request->query);
+   }
+
+   kms_request_str_append_chars (head, " HTTP/1.1", -1);
+   kms_request_str_append_newline (head);
+
+   kms_header_iter_init (&iter, request->proto_headers, request->header_fields);
+   while ((header = kms_header_iter_next (&iter))) {
+      kms_request_str_append (head, header->key);
+      kms_request_str_append_char (head, ':');
+      kms_request_str_append (head, header->value);
+      kms_request_str_append_newline (head);
+   }
+
+   /* note space after ':', to match test .sreq files */
+   kms_request_str_append_chars (head, "Authorization: ", -1);
+   request->signed_head_valid = true;
+}
+
+/* the signed request in pieces that point into "request": the head, the
+ * Authorization header's value, then the body after a blank line */
+static size_t
+signed_iov (kms_request_t *request, kms_iovec_t *iov)
+{
+   size_t n = 0;
+
+   build_signed_head (request);
+   iov[n].base = request->signed_head->str;
+   iov[n++].len = request->signed_head->len;
+   iov[n].base = request->authorization->str;
+   iov[n++].len = request->authorization->len;
+
+   if (payload_len (request)) {
+      iov[n].base = "\n\n";
+      iov[n++].len = 2;
+      iov[n].base = payload_chars (request);
+      iov[n++].len = payload_len (request);
+   }
+
+   return n;
+}
+
+static size_t
+iov_len (const kms_iovec_t *iov, size_t n)
+{
+   size_t len = 0;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      len += iov[i].len;
+   }
+
+   return len;
+}
+
+static void
+iov_copy (char *out, const kms_iovec_t *iov, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      memcpy (out, iov[i].base, iov[i].len);
+      out += iov[i].len;
+   }
+}
+
+/* a malloc'd copy of the signed request, allocated at its exact size */
+static char *
+signed_request (kms_request_t *request)
+{
+   kms_iovec_t iov[KMS_SIGNED_IOV_MAX];
+   size_t n;
+   size_t len;
+   char *out;
+
+   n = signed_iov (request, iov);
+   len = iov_len (iov, n);
+   out = kms_malloc (len + 1);
+   iov_copy (out, iov, n);
+   out[len] = '\0';
+
+   return out;
+}
+
+bool
+kms_request_resign (kms_request_t *request, const struct tm *tm)
+{
+   CHECK_FAILED;
+
+   return kms_request_set_date (request, tm) && build_signature (request);
+}
+
+char *
+kms_request_get_signed (kms_request_t *request)
+{
+   if (request->failed) {
+      return NULL;
+   }
+
+   if (!build_signature (request)) {
+      return NULL;
+   }
+
+   return signed_request (request);
+}
+
+bool
+kms_request_get_signed_iov (kms_request_t *request,
+                            kms_iovec_t *iov,
+                            size_t *iovcnt)
+{
+   if (request->failed) {
+      return false;
+   }
+
+   if (!build_signature (request)) {
+      return false;
+   }
+
+   *iovcnt = signed_iov (request, iov);
+   return true;
+}
+
+bool
+kms_request_get_signed_len (kms_request_t *request, size_t *len)
+{
+   kms_iovec_t iov[KMS_SIGNED_IOV_MAX];
+   size_t n;
+
+   if (!kms_request_get_signed_iov (request, iov, &n)) {
+      return false;
+   }
+
+   *len = iov_len (iov, n);
+   return true;
+}
+
+bool
+kms_request_write_signed (kms_request_t *request, char *buf, size_t size)
+{
+   kms_iovec_t iov[KMS_SIGNED_IOV_MAX];
+   size_t n;
+   size_t len;
+
+   if (!kms_request_get_signed_iov (request, iov, &n)) {
+      return false;
+   }
+
+   len = iov_len (iov, n);
+   if (size < len) {
+      return false;
+   }
+
+   iov_copy (buf, iov, n);
+   if (size > len) {
+      buf[len] = '\0';
+   }
+
+   return true;
+}
+
+char *
+kms_request_sign_chunk (kms_request_t *request, const char *data, size_t len)
+{
+   kms_request_str_t *sts;
+   kms_request_str_t *header;
+   unsigned char hash[32];
+   size_t remaining;
+
    if (request->failed) {
       return NULL;
    }
 
-   if (!finalize (request)) {
+   if (request->payload_hash_mode != PAYLOAD_STREAMING ||
+       !request->chunk_seeded) {
+      KMS_ERROR (request, "Sign a streaming request before its chunks");
       return NULL;
    }
 
-   sts = kms_request_str_new ();
-   kms_request_str_append_chars (sts, "AWS4-HMAC-SHA256\n", -1);
-   kms_request_str_append (sts, request->datetime);
-   kms_request_str_append_newline (sts);
+   /* the chunk sizes must add up to the Content-Length we signed */
+   remaining = request->decoded_len - request->chunked_len;
+   if (len > remaining ||
+       (len != request->chunk_size && len != remaining)) {
+      KMS_ERROR (request,
+                 "Chunk of %zu bytes, expected %zu",
+                 len,
+                 remaining < request->chunk_size ? remaining
+                                                 : request->chunk_size);
+      return NULL;
+   }
 
-   /* credential scope, like "20150830/us-east-1/service/aws4_request" */
-   kms_request_str_append (sts, request->date);
-   kms_request_str_append_char (sts, '/');
-   kms_request_str_append (sts, request->region);
-   kms_request_str_append_char (sts, '/');
-   kms_request_str_append (sts, request->service);
-   kms_request_str_append_chars (sts, "/aws4_request\n", -1);
+   if (!kms_sha256 (data, len, hash)) {
+      KMS_ERROR (request, "Could not hash chunk");
+      return NULL;
+   }
 
-   creq = kms_request_str_wrap (kms_request_get_canonical (request), -1);
-   if (!kms_request_str_append_hashed (sts, creq)) {
-      goto done;
+   /* "AWS4-HMAC-SHA256-PAYLOAD", date, scope, previous signature, hash of
+    * the empty string, hash of the chunk */
+   sts = kms_request_str_new ();
+   if (!append_string_to_sign_prefix (
+          request, "AWS4-HMAC-SHA256-PAYLOAD", sts)) {
+      kms_request_str_destroy (sts);
+      return NULL;
    }
 
-   success = true;
-done:
-   kms_request_str_destroy (creq);
-   if (!success) {
+   kms_request_str_append_hex (
+      sts, request->chunk_signature, sizeof (request->chunk_signature));
+   kms_request_str_append_newline (sts);
+   kms_request_str_append_chars (sts, EMPTY_HASH "\n", -1);
+   kms_request_str_append_hex (sts, hash, sizeof (hash));
+
+   if (!kms_hmac_sha256_keyed (&request->chunk_hmac,
+                               sts->str,
+                               sts->len,
+                               request->chunk_signature)) {
+      KMS_ERROR (request, "Could not sign chunk");
       kms_request_str_destroy (sts);
-      sts = NULL;
+      return NULL;
+   }
+
+   kms_request_str_destroy (sts);
+   request->chunked_len += len;
+   if (len == 0) {
+      /* that was the final chunk */
+      request->chunk_seeded = false;
    }
 
-   return kms_request_str_detach (sts);
+   /* like "400;chunk-signature=0055627c9e194cb4542bae2aa5492e3c...\r\n" */
+   header = kms_request_str_new ();
+   kms_request_str_appendf (header, "%zx;chunk-signature=", len);
+   kms_request_str_append_hex (
+      header, request->chunk_signature, sizeof (request->chunk_signature));
+   kms_request_str_append_chars (header, "\r\n", 2);
+
+   return kms_request_str_detach (header);
 }
 
+/* the HMAC midstates of the request's signing key, as built-in SHA-256 state */
 static bool
-kms_request_hmac (unsigned char *out,
-                  kms_request_str_t *key,
-                  kms_request_str_t *data)
+get_hmac_midstate (kms_request_t *request, uint32_t *inner, uint32_t *outer)
 {
-   return HMAC (EVP_sha256 (),
-                key->str,
-                (int) key->len,
-                (unsigned char *) data->str,
-                data->len,
-                out,
-                NULL) != NULL;
+   const kms_signer_slot_t *slot;
+   unsigned char key[32];
+
+   if (request->signer) {
+      slot = kms_signer_get_slot (
+         request->signer, request->date, request->datetime);
+      if (!slot) {
+         return false;
+      }
+
+      memcpy (inner, slot->hmac_inner, sizeof (slot->hmac_inner));
+      memcpy (outer, slot->hmac_outer, sizeof (slot->hmac_outer));
+      return true;
+   }
+
+   if (!kms_request_get_signing_key (request, key)) {
+      return false;
+   }
+
+   kms_sha256_hmac_midstate (key, sizeof (key), inner, outer);
+   return true;
 }
 
-static bool
-kms_request_hmac_again (unsigned char *out,
-                        unsigned char *in,
-                        kms_request_str_t *data)
+bool
+kms_request_sign_batch_with (kms_request_t **requests,
+                             size_t n,
+                             char **signed_out,
+                             kms_batch_item_t *items,
+                             kms_sha256_lane_t *lanes)
 {
-   return HMAC (EVP_sha256 (),
-                in,
-                32,
-                (unsigned char *) data->str,
-                data->len,
-                out,
-                NULL) != NULL;
+   bool success = true;
+   kms_batch_item_t *item;
+   kms_sha256_lane_t *lane;
+   kms_request_t *request;
+   size_t i, m = 0, n_hashes = 0, n_lanes = 0;
+
+   /* build each canonical request that isn't hashed yet, all of them in
+    * memory to hash them together. the requests that fail here are left out
+    * of the rest */
+   for (i = 0; i < n; i++) {
+      request = requests[i];
+      signed_out[i] = NULL;
+      item = &items[m];
+      item->request = request;
+      item->signed_out = &signed_out[i];
+      item->lane = NULL;
+      if (request->failed || !prepare_canonical (request)) {
+         success = false;
+         continue;
+      }
+
+      if (request->signature_valid) {
+         m++;
+         continue;
+      }
+
+      if (!request->canonical_hash_valid) {
+         if (!build_canonical_str (request)) {
+            success = false;
+            continue;
+         }
+
+         kms_sha256_lane_init (&lanes[n_hashes++],
+                               (const unsigned char *) request->canonical->str,
+                               request->canonical->len,
+                               request->canonical_hash);
+      }
+
+      kms_request_str_set_chars (request->string_to_sign, "", 0);
+      request->sts_valid = false;
+      if (!append_string_to_sign_prefix (
+             request, "AWS4-HMAC-SHA256", request->string_to_sign)) {
+         success = false;
+         continue;
+      }
+
+      if (!get_hmac_midstate (request, item->hmac_inner, item->hmac_outer)) {
+         KMS_ERROR (request, "Could not derive signing key");
+         success = false;
+         continue;
+      }
+
+      item->lane = &lanes[n_lanes++];
+      m++;
+   }
+
+   /* hash the canonical requests together, then the strings to sign */
+   kms_sha256_multi (lanes, n_hashes);
+
+   for (i = 0; i < m; i++) {
+      item = &items[i];
+      lane = item->lane;
+      if (!lane) {
+         continue;
+      }
+
+      request = item->request;
+      request->canonical_hash_valid = true;
+      kms_request_str_append_hex (request->string_to_sign,
+                                  request->canonical_hash,
+                                  sizeof (request->canonical_hash));
+      request->sts_valid = true;
+      memcpy (lane->h, item->hmac_inner, sizeof (lane->h));
+      lane->prefix_len = 64;
+      lane->msg = (const unsigned char *) request->string_to_sign->str;
+      lane->len = request->string_to_sign->len;
+      lane->hash_out = item->inner;
+   }
+
+   kms_sha256_multi (lanes, n_lanes);
+
+   for (i = 0; i < m; i++) {
+      item = &items[i];
+      lane = item->lane;
+      if (!lane) {
+         continue;
+      }
+
+      memcpy (lane->h, item->hmac_outer, sizeof (lane->h));
+      lane->prefix_len = 64;
+      lane->msg = item->inner;
+      lane->len = sizeof (item->inner);
+      lane->hash_out = item->signature;
+   }
+
+   kms_sha256_multi (lanes, n_lanes);
+
+   for (i = 0; i < m; i++) {
+      item = &items[i];
+      request = item->request;
+      if ((item->lane && !set_signature (request, item->signature)) ||
+          !build_signature (request)) {
+         success = false;
+         continue;
+      }
+
+      *item->signed_out = signed_request (request);
+   }
+
+   return success;
 }
 
 bool
-kms_request_get_signing_key (kms_request_t *request, unsigned char *key)
+kms_request_sign_batch (kms_request_t **requests, size_t n, char **signed_out)
 {
-   bool success = false;
-   kms_request_str_t *aws4_plus_secret = NULL;
-   kms_request_str_t *aws4_request = NULL;
-   unsigned char k_date[32];
-   unsigned char k_region[32];
-   unsigned char k_service[32];
+   kms_batch_item_t *items;
+   kms_sha256_lane_t *lanes;
+   bool success;
 
-   if (request->failed) {
-      return NULL;
+   items = kms_malloc ((n ? n : 1) * sizeof (kms_batch_item_t));
+   lanes = kms_malloc ((n ? n : 1) * sizeof (kms_sha256_lane_t));
+   success =
+      kms_request_sign_batch_with (requests, n, signed_out, items, lanes);
+   kms_free (lanes);
+   kms_free (items);
+
+   return success;
+}
+
+static bool
+is_presign_param (const char *key)
+{
+   return 0 == strcmp (key, "X-Amz-Algorithm") ||
+          0 == strcmp (key, "X-Amz-Credential") ||
+          0 == strcmp (key, "X-Amz-Date") ||
+          0 == strcmp (key, "X-Amz-Expires") ||
+          0 == strcmp (key, "X-Amz-SignedHeaders") ||
+          0 == strcmp (key, "X-Amz-Signature");
+}
+
+static void
+add_param (kms_kv_list_t *lst, const char *key, const char *value)
+{
+   kms_kv_list_add_chars (lst, key, strlen (key), value, strlen (value));
+}
+
+kms_presign_template_t *
+kms_presign_template_new (kms_request_t *request)
+{
+   kms_presign_template_t *tmpl =
+      kms_calloc (1, sizeof (kms_presign_template_t));
+   kms_header_list_t *headers = NULL;
+   kms_kv_list_t *params = NULL;
+   kms_request_str_t *signed_headers;
+   kms_request_sink_t sink;
+   kms_header_iter_t iter;
+   kms_request_str_t *cur;
+   kms_kv_t *kv;
+   size_t i;
+   int n = 0;
+
+   for (i = 0; i < 4; i++) {
+      tmpl->query[i] = kms_request_str_new ();
+   }
+
+   tmpl->path = kms_request_str_dup (request->path);
+   tmpl->region = kms_request_str_dup (request->region);
+   tmpl->service = kms_request_str_dup (request->service);
+   tmpl->creq_head = kms_request_str_new ();
+   tmpl->creq_tail = kms_request_str_new ();
+
+   if (request->failed || !finalize (request)) {
+      KMS_ERROR (tmpl, "%s", request->error);
+      return tmpl;
+   }
+
+   if (request->signer) {
+      tmpl->signer = request->signer;
+   } else if (request->has_signing_key) {
+      if (request->signing_key_rescoped) {
+         KMS_ERROR (tmpl,
+                    "Signing key is not for region %s and service %s",
+                    request->region->str,
+                    request->service->str);
+         return tmpl;
+      }
+
+      tmpl->has_signing_key = true;
+      memcpy (tmpl->signing_key, request->signing_key, 32);
+      memcpy (tmpl->signing_key_date,
+              request->signing_key_date,
+              sizeof tmpl->signing_key_date);
+   } else {
+      tmpl->signer = kms_signer_new (request->access_key_id->str,
+                                     request->secret_key->str,
+                                     request->region->str,
+                                     request->service->str);
+      tmpl->owns_signer = true;
    }
 
-   /* docs.aws.amazon.com/general/latest/gr/sigv4-calculate-signature.html
-    * Pseudocode for deriving a signing key
-    *
-    * kSecret = your secret access key
-    * kDate = HMAC("AWS4" + kSecret, Date)
-    * kRegion = HMAC(kDate, Region)
-    * kService = HMAC(kRegion, Service)
-    * kSigning = HMAC(kService, "aws4_request")
-    */
-   aws4_plus_secret = kms_request_str_new_from_chars ("AWS4", -1);
-   kms_request_str_append (aws4_plus_secret, request->secret_key);
-
-   aws4_request = kms_request_str_new_from_chars ("aws4_request", -1);
-
-   if (!(kms_request_hmac (k_date, aws4_plus_secret, request->date) &&
-         kms_request_hmac_again (k_region, k_date, request->region) &&
-         kms_request_hmac_again (k_service, k_region, request->service) &&
-         kms_request_hmac_again (key, k_service, aws4_request))) {
+   /* like "GET\n/test.txt\n" */
+   kms_request_str_append (tmpl->creq_head, request->method);
+   kms_request_str_append_newline (tmpl->creq_head);
+   append_canonical_path (tmpl->creq_head, request->path);
+   kms_request_str_append_newline (tmpl->creq_head);
+
+   /* the date is in the query, not a header */
+   headers = all_headers (request);
+   kms_header_list_del (headers, "Connection");
+   kms_header_list_del (headers, "X-Amz-Date");
+   signed_headers = kms_request_str_new ();
+   kms_request_sink_init_str (&sink, signed_headers);
+   kms_header_iter_init (&iter, headers, NULL);
+   append_signed_headers (&iter, &sink);
+   kms_request_sink_flush (&sink);
+
+   kms_request_sink_init_str (&sink, tmpl->creq_tail);
+   kms_request_sink_append_char (&sink, '\n');
+   kms_header_iter_init (&iter, headers, NULL);
+   append_canonical_headers (&iter, &sink);
+   kms_request_sink_append_char (&sink, '\n');
+   kms_request_sink_append (&sink, signed_headers);
+   kms_request_sink_append_char (&sink, '\n');
+   if (!append_payload_hash (request, &sink)) {
+      KMS_ERROR (tmpl, "Could not hash payload");
       goto done;
    }
 
-   success = true;
+   kms_request_sink_flush (&sink);
+
+   /* sort the request's query parameters with ours, whose values that change
+    * we leave out */
+   params = kms_kv_list_dup (request->query_params);
+   for (i = 0; i < params->len; i++) {
+      if (is_presign_param (params->kvs[i].key->str)) {
+         KMS_ERROR (
+            tmpl, "Cannot presign a query with %s", params->kvs[i].key->str);
+         goto done;
+      }
+   }
+
+   add_param (params, "X-Amz-Algorithm", "AWS4-HMAC-SHA256");
+   add_param (params, "X-Amz-Credential", "");
+   add_param (params, "X-Amz-Date", "");
+   add_param (params, "X-Amz-Expires", "");
+   kms_kv_list_add_owned (
+      params,
+      kms_request_str_new_from_chars ("X-Amz-SignedHeaders", -1),
+      signed_headers);
+   signed_headers = NULL;
+   kms_kv_list_sort (params, cmp_query_params);
+
+   cur = tmpl->query[0];
+   for (i = 0; i < params->len; i++) {
+      kv = &params->kvs[i];
+      if (i > 0) {
+         kms_request_str_append_char (cur, '&');
+      }
+
+      kms_request_str_append_escaped (cur, kv->key, true);
+      kms_request_str_append_char (cur, '=');
+      if (0 == strcmp (kv->key->str, "X-Amz-Credential")) {
+         /* like "AKIDEXAMPLE%2F" <date> "%2Fus-east-1%2Fs3%2Faws4_request" */
+         kms_request_str_append_escaped (cur, request->access_key_id, true);
+         kms_request_str_append_chars (cur, "%2F", -1);
+         cur = tmpl->query[++n];
+         kms_request_str_append_chars (cur, "%2F", -1);
+         kms_request_str_append_escaped (cur, request->region, true);
+         kms_request_str_append_chars (cur, "%2F", -1);
+         kms_request_str_append_escaped (cur, request->service, true);
+         kms_request_str_append_chars (cur, "%2Faws4_request", -1);
+      } else if (0 == strcmp (kv->key->str, "X-Amz-Date") ||
+                 0 == strcmp (kv->key->str, "X-Amz-Expires")) {
+         cur = tmpl->query[++n];
+      } else {
+         kms_request_str_append_escaped (cur, kv->value, true);
+      }
+   }
+
 done:
-   kms_request_str_destroy (aws4_plus_secret);
-   kms_request_str_destroy (aws4_request);
+   kms_request_str_destroy (signed_headers);
+   kms_header_list_destroy (headers);
+   kms_kv_list_destroy (params);
 
-   return success;
+   return tmpl;
+}
+
+void
+kms_presign_template_destroy (kms_presign_template_t *tmpl)
+{
+   size_t i;
+
+   if (!tmpl) {
+      return;
+   }
+
+   for (i = 0; i < 4; i++) {
+      kms_request_str_destroy (tmpl->query[i]);
+   }
+
+   kms_request_str_destroy (tmpl->path);
+   kms_request_str_destroy (tmpl->region);
+   kms_request_str_destroy (tmpl->service);
+   kms_request_str_destroy (tmpl->creq_head);
+   kms_request_str_destroy (tmpl->creq_tail);
+   if (tmpl->owns_signer) {
+      kms_signer_destroy (tmpl->signer);
+   }
+
+   kms_free (tmpl);
+}
+
+const char *
+kms_presign_template_get_error (kms_presign_template_t *tmpl)
+{
+   return tmpl->failed ? tmpl->error : NULL;
+}
+
+/* the canonical query with the date, datetime, and expiry filled in */
+static void
+append_presign_query (kms_presign_template_t *tmpl,
+                      kms_request_sink_t *sink,
+                      const char *datetime,
+                      const char *expires)
+{
+   kms_request_sink_append (sink, tmpl->query[0]);
+   kms_request_sink_append_chars (sink, datetime, sizeof "YYYYmmDD" - 1);
+   kms_request_sink_append (sink, tmpl->query[1]);
+   kms_request_sink_append_chars (sink, datetime, -1);
+   kms_request_sink_append (sink, tmpl->query[2]);
+   kms_request_sink_append_chars (sink, expires, -1);
+   kms_request_sink_append (sink, tmpl->query[3]);
 }
 
 char *
-kms_request_get_signature (kms_request_t *request)
+kms_presign_template_sign (kms_presign_template_t *tmpl,
+                           const struct tm *tm,
+                           int expires)
 {
    bool success = false;
-   kms_kv_list_t *lst = NULL;
-   kms_request_str_t *sig = NULL;
-   kms_request_str_t *sts = NULL;
-   unsigned char signing_key[32];
+   char datetime[sizeof "YYYYmmDDTHHMMSSZ"];
+   char expires_str[16];
+   struct tm tmp_tm;
+   time_t t;
+   kms_request_sink_t sink;
+   kms_request_str_t *sts;
+   kms_request_str_t *url = NULL;
+   kms_request_str_t *date_str = NULL;
+   kms_request_str_t *datetime_str = NULL;
+   const kms_signer_slot_t *slot;
+   unsigned char hash[32];
    unsigned char signature[32];
 
-   if (request->failed) {
+   if (tmpl->failed) {
       return NULL;
    }
 
-   sts = kms_request_str_wrap (kms_request_get_string_to_sign (request), -1);
-   if (!sts) {
-      goto done;
+   /* SigV4 allows at most seven days */
+   if (expires < 1 || expires > 604800) {
+      KMS_ERROR (tmpl, "Expiry must be 1 to 604800 seconds, not %d", expires);
+      return NULL;
    }
 
-   sig = kms_request_str_new ();
-   kms_request_str_append_chars (sig, "AWS4-HMAC-SHA256 Credential=", -1);
-   kms_request_str_append (sig, request->access_key_id);
-   kms_request_str_append_char (sig, '/');
-   kms_request_str_append (sig, request->date);
-   kms_request_str_append_char (sig, '/');
-   kms_request_str_append (sig, request->region);
-   kms_request_str_append_char (sig, '/');
-   kms_request_str_append (sig, request->service);
-   kms_request_str_append_chars (sig, "/aws4_request, SignedHeaders=", -1);
-   lst = canonical_headers (request);
-   append_signed_headers (lst, sig);
-   kms_request_str_append_chars (sig, ", Signature=", -1);
-   if (!(kms_request_get_signing_key (request, signing_key) &&
-         kms_request_hmac_again (signature, signing_key, sts))) {
-      goto done;
+   if (!tm) {
+      t = (time_t) kms_clock_now ();
+      if (!gmtime_r (&t, &tmp_tm)) {
+         KMS_ERROR (tmpl, "Could not format the current time");
+         return NULL;
+      }
+
+      tm = &tmp_tm;
+   }
+
+   if (0 == strftime (datetime, sizeof datetime, "%Y%m%dT%H%M%SZ", tm)) {
+      KMS_ERROR (tmpl, "Invalid tm struct");
+      return NULL;
+   }
+
+   sprintf (expires_str, "%d", expires);
+
+   /* hash the canonical request as it's written */
+   if (!kms_request_sink_init_sha256 (&sink)) {
+      KMS_ERROR (tmpl, "Could not hash canonical request");
+      return NULL;
+   }
+
+   kms_request_sink_append (&sink, tmpl->creq_head);
+   append_presign_query (tmpl, &sink, datetime, expires_str);
+   kms_request_sink_append (&sink, tmpl->creq_tail);
+   if (!kms_request_sink_final (&sink, hash)) {
+      KMS_ERROR (tmpl, "Could not hash canonical request");
+      return NULL;
+   }
+
+   /* like "AWS4-HMAC-SHA256\n20130524T000000Z\n20130524/us-east-1/s3/..." */
+   sts = kms_request_str_new_from_chars ("AWS4-HMAC-SHA256\n", -1);
+   kms_request_str_append_chars (sts, datetime, -1);
+   kms_request_str_append_newline (sts);
+   kms_request_str_append_chars (sts, datetime, sizeof "YYYYmmDD" - 1);
+   kms_request_str_append_char (sts, '/');
+   kms_request_str_append (sts, tmpl->region);
+   kms_request_str_append_char (sts, '/');
+   kms_request_str_append (sts, tmpl->service);
+   kms_request_str_append_chars (sts, "/aws4_request\n", -1);
+   kms_request_str_append_hex (sts, hash, sizeof (hash));
+
+   if (tmpl->signer) {
+      date_str =
+         kms_request_str_new_from_chars (datetime, sizeof "YYYYmmDD" - 1);
+      datetime_str = kms_request_str_new_from_chars (datetime, -1);
+      slot = kms_signer_get_slot (tmpl->signer, date_str, datetime_str);
+      if (!slot ||
+          !kms_hmac_sha256_keyed (&slot->hmac, sts->str, sts->len, signature)) {
+         KMS_ERROR (tmpl, "Could not sign");
+         goto done;
+      }
+   } else {
+      if (0 != strncmp (tmpl->signing_key_date,
+                        datetime,
+                        sizeof tmpl->signing_key_date - 1)) {
+         KMS_ERROR (tmpl,
+                    "Signing key is for %s, URL date is %.8s",
+                    tmpl->signing_key_date,
+                    datetime);
+         goto done;
+      }
+
+      if (!kms_sha256_hmac ((char *) tmpl->signing_key,
+                            sizeof (tmpl->signing_key),
+                            sts->str,
+                            sts->len,
+                            signature)) {
+         KMS_ERROR (tmpl, "Could not sign");
+         goto done;
+      }
    }
 
-   kms_request_str_append_hex (sig, signature, sizeof (signature));
+   url = kms_request_str_dup (tmpl->path);
+   kms_request_sink_init_str (&sink, url);
+   kms_request_sink_append_char (&sink, '?');
+   append_presign_query (tmpl, &sink, datetime, expires_str);
+   kms_request_sink_append_chars (&sink, "&X-Amz-Signature=", -1);
+   kms_request_sink_append_hex (&sink, signature, sizeof (signature));
+   kms_request_sink_flush (&sink);
    success = true;
+
 done:
-   kms_kv_list_destroy (lst);
    kms_request_str_destroy (sts);
-
+   kms_request_str_destroy (date_str);
+   kms_request_str_destroy (datetime_str);
    if (!success) {
-      kms_request_str_destroy (sig);
-      sig = NULL;
+      kms_request_str_destroy (url);
+      return NULL;
    }
 
-   return kms_request_str_detach (sig);
+   return kms_request_str_detach (url);
 }
 
-char *
-kms_request_get_signed (kms_request_t *request)
+/* the lengths of a clone's signed head, signed headers, and Authorization
+ * header, which repeat the prototype's request line and headers. a clone
+ * reserves them up front so they don't grow through its arena. */
+static void
+clone_reserve (kms_request_proto_t *proto)
 {
-   bool success = false;
-   kms_kv_list_t *lst = NULL;
-   char *signature = NULL;
-   kms_request_str_t *sreq = NULL;
+   const kms_request_t *frozen = proto->frozen;
+   const kms_header_list_t *headers = frozen->header_fields;
+   const kms_header_t *header;
    size_t i;
 
+   proto->head_len = frozen->method->len + sizeof " " + frozen->path->len +
+                     sizeof "?" + frozen->query->len + sizeof " HTTP/1.1\n" +
+                     CLONE_HEADERS_LEN + sizeof "Authorization: ";
+   proto->signed_headers_len = sizeof "content-length;x-amz-date";
+   for (i = 0; i < headers->len; i++) {
+      header = &headers->headers[i];
+      proto->head_len += header->key->len + header->value->len + 2;
+      proto->signed_headers_len += header->key->len + 1;
+   }
+
+   proto->auth_len = sizeof "AWS4-HMAC-SHA256 Credential=" +
+                     frozen->access_key_id->len + sizeof "/YYYYmmDD/" +
+                     frozen->region->len + frozen->service->len +
+                     sizeof "//aws4_request, SignedHeaders=" +
+                     proto->signed_headers_len + sizeof ", Signature=" + 64;
+
+   /* reserving rounds up to a power of 2, less than twice the length */
+   proto->clone_size =
+      CLONE_FIXED_SIZE +
+      2 * (proto->head_len + proto->signed_headers_len + proto->auth_len);
+}
+
+kms_request_proto_t *
+kms_request_proto_new (kms_request_t *request)
+{
+   kms_request_proto_t *proto = kms_calloc (1, sizeof (kms_request_proto_t));
+   kms_request_t *frozen;
+
    if (request->failed) {
-      return NULL;
+      KMS_ERROR (proto, "%s", request->error);
+      return proto;
    }
 
-   if (!finalize (request)) {
-      return NULL;
+   /* its headers depend on its payload now */
+   if (request->finalized) {
+      KMS_ERROR (proto, "Cannot make a prototype of a signed request");
+      return proto;
    }
 
-   sreq = kms_request_str_new ();
-   /* like "POST / HTTP/1.1" */
-   kms_request_str_append (sreq, request->method);
-   kms_request_str_append_char (sreq, ' ');
-   kms_request_str_append (sreq, request->path);
-   if (request->query->len) {
-      kms_request_str_append_char (sreq, '?');
-      kms_request_str_append (sreq, request->query);
+   frozen = proto->frozen = kms_calloc (1, sizeof (kms_request_t));
+   frozen->method = kms_request_str_dup (request->method);
+   frozen->path = kms_request_str_dup (request->path);
+   frozen->query = kms_request_str_dup (request->query);
+   frozen->query_params = kms_kv_list_dup (request->query_params);
+   kms_kv_list_sort (frozen->query_params, cmp_query_params);
+   frozen->query_sorted = true;
+   frozen->canonical_path = kms_request_str_new ();
+   append_canonical_path (frozen->canonical_path, request->path);
+
+   frozen->region = kms_request_str_dup (request->region);
+   frozen->service = kms_request_str_dup (request->service);
+   frozen->access_key_id = kms_request_str_dup (request->access_key_id);
+   frozen->secret_key = kms_request_str_dup (request->secret_key);
+   frozen->signer = request->signer;
+   frozen->has_signing_key = request->has_signing_key;
+   frozen->signing_key_rescoped = request->signing_key_rescoped;
+   memcpy (frozen->signing_key, request->signing_key, 32);
+   memcpy (frozen->signing_key_date,
+           request->signing_key_date,
+           sizeof frozen->signing_key_date);
+
+   frozen->content_sha256 = request->content_sha256;
+   frozen->auto_content_length = request->auto_content_length;
+   /* a supplied hash is for the request's payload, not the clones' */
+   if (request->payload_hash_mode != PAYLOAD_HASH_SUPPLIED) {
+      frozen->payload_hash_mode = request->payload_hash_mode;
    }
 
-   kms_request_str_append_chars (sreq, " HTTP/1.1", -1);
-   kms_request_str_append_newline (sreq);
+   frozen->decoded_len = request->decoded_len;
+   frozen->chunk_size = request->chunk_size;
 
-   /* headers */
-   lst = kms_kv_list_dup (request->header_fields);
-   kms_kv_list_sort (lst, cmp_header_field_names);
-   for (i = 0; i < lst->len; i++) {
-      kms_request_str_append (sreq, lst->kvs[i].key);
-      kms_request_str_append_char (sreq, ':');
-      kms_request_str_append (sreq, lst->kvs[i].value);
-      kms_request_str_append_newline (sreq);
+   /* each clone has its own date */
+   frozen->header_fields = all_headers (request);
+   kms_header_list_del (frozen->header_fields, "X-Amz-Date");
+   if (!kms_header_list_find (frozen->header_fields, "Host")) {
+      add_host (frozen, frozen->header_fields);
    }
 
-   /* authorization header */
-   signature = kms_request_get_signature (request);
-   if (!signature) {
-      goto done;
-   }
+   clone_reserve (proto);
+   return proto;
+}
 
-   /* note space after ':', to match test .sreq files */
-   kms_request_str_append_chars (sreq, "Authorization: ", -1);
-   kms_request_str_append_chars (sreq, signature, -1);
+void
+kms_request_proto_destroy (kms_request_proto_t *proto)
+{
+   if (!proto) {
+      return;
+   }
 
-   /* body */
-   if (request->payload->len) {
-      kms_request_str_append_newline (sreq);
-      kms_request_str_append_newline (sreq);
-      kms_request_str_append (sreq, request->payload);
+   if (proto->frozen) {
+      kms_request_destroy (proto->frozen);
    }
 
-   success = true;
-done:
-   free (signature);
-   kms_kv_list_destroy (lst);
+   kms_free (proto);
+}
 
-   if (!success) {
-      kms_request_str_destroy (sreq);
-      sreq = NULL;
+const char *
+kms_request_proto_get_error (const kms_request_proto_t *proto)
+{
+   return proto->failed ? proto->error : NULL;
+}
+
+kms_request_t *
+kms_request_new_from_proto (const kms_request_proto_t *proto)
+{
+   return kms_request_new_from_proto_sized (proto, 0);
+}
+
+kms_request_t *
+kms_request_new_from_proto_sized (const kms_request_proto_t *proto,
+                                  size_t payload_len)
+{
+   const kms_request_t *frozen = proto->frozen;
+   kms_arena_t *arena;
+   kms_request_t *request;
+
+   if (proto->failed) {
+      /* an empty request that reports the prototype's error */
+      request = request_alloc (NULL, false);
+      alloc_target (request);
+      alloc_credentials (request);
+      KMS_ERROR (request, "%s", proto->error);
+      return request;
+   }
+
+   /* the clone and everything it fills in up to its signature are in one
+    * chunk, and so is a payload up to "payload_len". a longer one grows
+    * through the arena. */
+   arena = kms_arena_new (NULL, 0, proto->clone_size + 2 * payload_len);
+   request = request_alloc (arena, true);
+   kms_request_str_reserve (request->signed_head, proto->head_len);
+   kms_request_str_reserve (request->signed_headers, proto->signed_headers_len);
+   kms_request_str_reserve (request->authorization, proto->auth_len);
+   if (payload_len) {
+      kms_request_str_reserve (request->payload, payload_len);
    }
 
-   return kms_request_str_detach (sreq);
+   /* borrow everything but the date and payload */
+   request->shares_target = true;
+   request->method = frozen->method;
+   request->path = frozen->path;
+   request->query = frozen->query;
+   request->query_params = frozen->query_params;
+   request->query_sorted = true;
+   request->canonical_path = frozen->canonical_path;
+   request->canonical_path_valid = true;
+   request->shares_credentials = true;
+   request->region = frozen->region;
+   request->service = frozen->service;
+   request->access_key_id = frozen->access_key_id;
+   request->secret_key = frozen->secret_key;
+   request->proto_headers = frozen->header_fields;
+
+   request->signer = frozen->signer;
+   request->has_signing_key = frozen->has_signing_key;
+   request->signing_key_rescoped = frozen->signing_key_rescoped;
+   memcpy (request->signing_key, frozen->signing_key, 32);
+   memcpy (request->signing_key_date,
+           frozen->signing_key_date,
+           sizeof request->signing_key_date);
+   request->content_sha256 = frozen->content_sha256;
+   request->auto_content_length = frozen->auto_content_length;
+   request->payload_hash_mode = frozen->payload_hash_mode;
+   request->decoded_len = frozen->decoded_len;
+   request->chunk_size = frozen->chunk_size;
+
+   kms_request_set_date (request, NULL);
+
+   return request;
 }
@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include "kms_alloc.h"
+#include "kms_arena.h"
 #include "kms_request_opt_private.h"
 
 #include <stdlib.h>
@@ -22,13 +24,13 @@
 kms_request_opt_t *
 kms_request_opt_new (void)
 {
-   return calloc (1, sizeof (kms_request_opt_t));
+   return kms_calloc (1, sizeof (kms_request_opt_t));
 }
 
 void
 kms_request_opt_destroy (kms_request_opt_t *request)
 {
-   free (request);
+   kms_free (request);
 }
 
 void
@@ -37,3 +39,22 @@ kms_request_opt_set_connection_close (kms_request_opt_t *opt,
 {
    opt->connection_close = connection_close;
 }
+
+void
+kms_request_opt_set_content_sha256 (kms_request_opt_t *opt,
+                                    bool content_sha256)
+{
+   opt->content_sha256 = content_sha256;
+}
+
+void
+kms_request_opt_set_arena (kms_request_opt_t *opt,
+                           void *block,
+                           size_t block_size,
+                           size_t chunk_size)
+{
+   opt->use_arena = true;
+   opt->arena_block = block;
+   opt->arena_block_size = block ? block_size : 0;
+   opt->arena_chunk_size = chunk_size ? chunk_size : KMS_ARENA_CHUNK_SIZE;
+}
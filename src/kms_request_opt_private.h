@@ -21,9 +21,15 @@
 #include "kms_message/kms_request_opt.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct _kms_request_opt_t {
    bool connection_close;
+   bool content_sha256;
+   bool use_arena;
+   void *arena_block;
+   size_t arena_block_size;
+   size_t arena_chunk_size;
 };
 
 #endif /* KMS_REQUEST_OPT_PRIVATE_H */
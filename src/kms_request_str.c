@@ -14,7 +14,7 @@
  * limitations under the License.
  */
 
-#include "hexlify.h"
+#include "kms_alloc.h"
 #include "kms_crypto.h"
 #include "kms_message/kms_message.h"
 #include "kms_request_str.h"
@@ -24,8 +24,6 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
 
 bool rfc_3986_tab[256] = {0};
 bool kms_initialized = false;
@@ -57,7 +55,7 @@ kms_strdupv_printf (const char *format, va_list args)
 
    assert (format);
 
-   buf = malloc ((size_t) len);
+   buf = kms_malloc ((size_t) len);
 
    while (true) {
       va_copy (my_args, args);
@@ -74,32 +72,57 @@ kms_strdupv_printf (const char *format, va_list args)
          len *= 2;
       }
 
-      buf = realloc (buf, (size_t) len);
+      buf = kms_realloc (buf, (size_t) len);
    }
 }
 
-kms_request_str_t *
-kms_request_str_new (void)
+static bool
+is_inline (const kms_request_str_t *str)
 {
-   kms_request_str_t *s = malloc (sizeof (kms_request_str_t));
+   return str->str == str->inline_buf;
+}
+
+/* an empty string with room for "len" chars, inline if they fit */
+static kms_request_str_t *
+str_alloc (kms_arena_t *arena, size_t len)
+{
+   kms_request_str_t *s = kms_arena_alloc (arena, sizeof (kms_request_str_t));
+
+   if (len < sizeof (s->inline_buf)) {
+      s->str = s->inline_buf;
+      s->size = sizeof (s->inline_buf);
+   } else {
+      s->size = len + 1;
+      s->str = kms_arena_alloc (arena, s->size);
+   }
 
-   s->len = 0;
-   s->size = 16;
-   s->str = malloc (s->size);
    s->str[0] = '\0';
+   s->len = 0;
+   s->arena = arena;
 
    return s;
 }
 
+kms_request_str_t *
+kms_request_str_new (void)
+{
+   return str_alloc (NULL, 0);
+}
+
+kms_request_str_t *
+kms_request_str_new_in (kms_arena_t *arena)
+{
+   return str_alloc (arena, 0);
+}
+
 kms_request_str_t *
 kms_request_str_new_from_chars (const char *chars, ssize_t len)
 {
-   kms_request_str_t *s = malloc (sizeof (kms_request_str_t));
+   kms_request_str_t *s;
    size_t actual_len;
 
    actual_len = len < 0 ? strlen (chars) : (size_t) len;
-   s->size = actual_len + 1;
-   s->str = malloc (s->size);
+   s = str_alloc (NULL, actual_len);
    memcpy (s->str, chars, actual_len);
    s->str[actual_len] = '\0';
    s->len = actual_len;
@@ -110,11 +133,12 @@ kms_request_str_new_from_chars (const char *chars, ssize_t len)
 kms_request_str_t *
 kms_request_str_wrap (char *chars, ssize_t len)
 {
-   kms_request_str_t *s = malloc (sizeof (kms_request_str_t));
+   kms_request_str_t *s = kms_malloc (sizeof (kms_request_str_t));
 
    s->str = chars;
    s->len = len < 0 ? strlen (chars) : (size_t) len;
    s->size = s->len;
+   s->arena = NULL;
 
    return s;
 }
@@ -126,15 +150,30 @@ kms_request_str_destroy (kms_request_str_t *str)
       return;
    }
 
-   free (str->str);
-   free (str);
+   if (!is_inline (str)) {
+      kms_arena_free (str->arena, str->str);
+   }
+
+   kms_arena_free (str->arena, str);
 }
 
 char *
 kms_request_str_detach (kms_request_str_t *str)
 {
-   char *r = str->str;
-   free (str);
+   char *r;
+
+   if (!str) {
+      return NULL;
+   }
+
+   if (str->arena || is_inline (str)) {
+      r = kms_strndup (str->str, str->len);
+      kms_arena_free (str->arena, str);
+      return r;
+   }
+
+   r = str->str;
+   kms_free (str);
    return r;
 }
 
@@ -159,8 +198,17 @@ kms_request_str_reserve (kms_request_str_t *str, size_t size)
       next_size |= next_size >> 16U;
       ++next_size;
 
+      if (is_inline (str)) {
+         str->str = kms_arena_alloc (str->arena, next_size);
+         if (str->str) {
+            memcpy (str->str, str->inline_buf, str->len + 1);
+         }
+      } else {
+         str->str =
+            kms_arena_realloc (str->arena, str->str, str->size, next_size);
+      }
+
       str->size = next_size;
-      str->str = realloc (str->str, next_size);
    }
 
    return str->str != NULL;
@@ -169,11 +217,11 @@ kms_request_str_reserve (kms_request_str_t *str, size_t size)
 kms_request_str_t *
 kms_request_str_dup (kms_request_str_t *str)
 {
-   kms_request_str_t *dup = malloc (sizeof (kms_request_str_t));
+   kms_request_str_t *dup = str_alloc (NULL, str->len);
 
-   dup->str = strndup (str->str, str->len);
+   memcpy (dup->str, str->str, str->len);
+   dup->str[str->len] = '\0';
    dup->len = str->len;
-   dup->size = str->len + 1;
 
    return dup;
 }
@@ -185,7 +233,8 @@ kms_request_str_set_chars (kms_request_str_t *str,
 {
    size_t actual_len = len < 0 ? strlen (chars) : (size_t) len;
    kms_request_str_reserve (str, actual_len); /* adds 1 for nil */
-   memcpy (str->str, chars, actual_len + 1);
+   memcpy (str->str, chars, actual_len);
+   str->str[actual_len] = '\0';
    str->len = actual_len;
 }
 
@@ -204,9 +253,7 @@ kms_request_str_ends_with (kms_request_str_t *str, kms_request_str_t *suffix)
 void
 kms_request_str_append (kms_request_str_t *str, kms_request_str_t *appended)
 {
-   size_t next_len = str->len + appended->len;
-
-   kms_request_str_reserve (str, next_len);
+   kms_request_str_reserve (str, appended->len);
    memcpy (str->str + str->len, appended->str, appended->len);
    str->len += appended->len;
    str->str[str->len] = '\0';
@@ -246,20 +293,11 @@ void
 kms_request_str_append_lowercase (kms_request_str_t *str,
                                   kms_request_str_t *appended)
 {
-   size_t i;
-   char *p;
+   kms_request_sink_t sink;
 
-   i = str->len;
-   kms_request_str_append (str, appended);
-
-   /* downcase the chars from the old end to the new end of str */
-   for (; i < str->len; ++i) {
-      p = &str->str[i];
-      /* ignore UTF-8 non-ASCII chars, which have 1 in the top bit */
-      if ((*p & (0x1U << 7U)) == 0) {
-         *p = (char) tolower (*p);
-      }
-   }
+   kms_request_sink_init_str (&sink, str);
+   kms_request_sink_append_lowercase (&sink, appended);
+   kms_request_sink_flush (&sink);
 }
 
 void
@@ -298,73 +336,22 @@ kms_request_str_append_escaped (kms_request_str_t *str,
                                 kms_request_str_t *appended,
                                 bool escape_slash)
 {
-   uint8_t *in;
-   uint8_t *out;
-   size_t i;
+   kms_request_sink_t sink;
 
-   tables_init ();
-
-   /* might replace each input char with 3 output chars: "%AB" */
-   kms_request_str_reserve (str, 3 * appended->len);
-   in = (uint8_t *) appended->str;
-   out = (uint8_t *) str->str + str->len;
-
-   for (i = 0; i < appended->len; ++i) {
-      if (rfc_3986_tab[*in] || (*in == '/' && !escape_slash)) {
-         *out = *in;
-         ++out;
-         ++str->len;
-      } else {
-         sprintf ((char *) out, "%%%02X", *in);
-         out += 3;
-         str->len += 3;
-      }
-
-      ++in;
-   }
+   kms_request_sink_init_str (&sink, str);
+   kms_request_sink_append_escaped (&sink, appended, escape_slash);
+   kms_request_sink_flush (&sink);
 }
 
 void
 kms_request_str_append_stripped (kms_request_str_t *str,
                                  kms_request_str_t *appended)
 {
-   const char *src = appended->str;
-   const char *end = appended->str + appended->len;
-   bool space = false;
-   bool comma = false;
-
-   kms_request_str_reserve (str, appended->len);
-
-   while (isspace (*src)) {
-      ++src;
-   }
-
-   while (src < end) {
-      /* replace newlines with commas. not documented but see
-       * get-header-value-multiline.creq */
-      if (*src == '\n') {
-         comma = true;
-         space = false;
-      } else if (isspace (*src)) {
-         space = true;
-      } else {
-         if (comma) {
-            kms_request_str_append_char (str, ',');
-            comma = false;
-            space = false;
-         }
-
-         /* is there a run of spaces waiting to be written as one space? */
-         if (space) {
-            kms_request_str_append_char (str, ' ');
-            space = false;
-         }
-
-         kms_request_str_append_char (str, *src);
-      }
+   kms_request_sink_t sink;
 
-      ++src;
-   }
+   kms_request_sink_init_str (&sink, str);
+   kms_request_sink_append_stripped (&sink, appended);
+   kms_request_sink_flush (&sink);
 }
 
 bool
@@ -372,31 +359,24 @@ kms_request_str_append_hashed (kms_request_str_t *str,
                                kms_request_str_t *appended)
 {
    uint8_t hash[32];
-   char *hex_chars;
 
    if (!kms_sha256 (appended->str, appended->len, hash)) {
       return false;
    }
 
-   hex_chars = hexlify (hash, sizeof (hash));
-   kms_request_str_append_chars (str, hex_chars, 2 * sizeof (hash));
-   free (hex_chars);
-
-   return true;
+   return kms_request_str_append_hex (str, hash, sizeof (hash));
 }
 
 bool
 kms_request_str_append_hex (kms_request_str_t *str,
-                            unsigned char *data,
+                            const unsigned char *data,
                             size_t len)
 {
-   char *hex_chars;
-
-   hex_chars = hexlify (data, len);
-   kms_request_str_append_chars (str, hex_chars, len * 2);
-   free (hex_chars);
+   kms_request_sink_t sink;
 
-   return true;
+   kms_request_sink_init_str (&sink, str);
+   kms_request_sink_append_hex (&sink, data, len);
+   return kms_request_sink_flush (&sink);
 }
 
 static bool
@@ -445,7 +425,7 @@ kms_request_str_path_normalized (kms_request_str_t *str)
 {
    kms_request_str_t *slash = kms_request_str_new_from_chars ("/", 1);
    kms_request_str_t *out = kms_request_str_new ();
-   char *in = strdup (str->str);
+   char *in = kms_strdup (str->str);
    char *p = in;
    char *end = in + str->len;
    bool is_absolute = (*p == '/');
@@ -512,7 +492,7 @@ kms_request_str_path_normalized (kms_request_str_t *str)
    }
 
 done:
-   free (in);
+   kms_free (in);
    kms_request_str_destroy (slash);
 
    if (!out->len) {
@@ -521,3 +501,210 @@ done:
 
    return out;
 }
+
+void
+kms_request_sink_init_str (kms_request_sink_t *sink, kms_request_str_t *str)
+{
+   sink->str = str;
+   sink->hashing = false;
+   sink->failed = false;
+   sink->len = 0;
+}
+
+bool
+kms_request_sink_init_sha256 (kms_request_sink_t *sink)
+{
+   sink->str = NULL;
+   sink->failed = false;
+   sink->len = 0;
+   sink->hashing = kms_crypto_get ()->sha256_init (&sink->state);
+   return sink->hashing;
+}
+
+static void
+sink_write (kms_request_sink_t *sink, const char *data, size_t len)
+{
+   if (sink->str) {
+      kms_request_str_append_chars (sink->str, data, (ssize_t) len);
+   } else if (!sink->failed &&
+              !kms_crypto_get ()->sha256_update (&sink->state, data, len)) {
+      sink->failed = true;
+   }
+}
+
+bool
+kms_request_sink_flush (kms_request_sink_t *sink)
+{
+   if (sink->len) {
+      sink_write (sink, sink->buf, sink->len);
+      sink->len = 0;
+   }
+
+   return !sink->failed;
+}
+
+bool
+kms_request_sink_final (kms_request_sink_t *sink, unsigned char *hash_out)
+{
+   kms_request_sink_flush (sink);
+   if (!sink->hashing) {
+      return !sink->failed;
+   }
+
+   sink->hashing = false;
+   if (sink->failed) {
+      kms_crypto_get ()->sha256_cleanup (&sink->state);
+      return false;
+   }
+
+   return kms_crypto_get ()->sha256_final (&sink->state, hash_out);
+}
+
+void
+kms_request_sink_cleanup (kms_request_sink_t *sink)
+{
+   if (sink->hashing) {
+      kms_crypto_get ()->sha256_cleanup (&sink->state);
+      sink->hashing = false;
+   }
+}
+
+void
+kms_request_sink_append_chars (kms_request_sink_t *sink,
+                               const char *appended,
+                               ssize_t len)
+{
+   size_t n = len < 0 ? strlen (appended) : (size_t) len;
+
+   if (sink->len + n <= sizeof (sink->buf)) {
+      memcpy (sink->buf + sink->len, appended, n);
+      sink->len += n;
+      return;
+   }
+
+   /* too big to buffer, write it through */
+   kms_request_sink_flush (sink);
+   sink_write (sink, appended, n);
+}
+
+void
+kms_request_sink_append (kms_request_sink_t *sink,
+                         const kms_request_str_t *appended)
+{
+   kms_request_sink_append_chars (sink, appended->str, (ssize_t) appended->len);
+}
+
+void
+kms_request_sink_append_char (kms_request_sink_t *sink, char c)
+{
+   if (sink->len == sizeof (sink->buf)) {
+      kms_request_sink_flush (sink);
+   }
+
+   sink->buf[sink->len++] = c;
+}
+
+void
+kms_request_sink_append_lowercase (kms_request_sink_t *sink,
+                                   const kms_request_str_t *appended)
+{
+   size_t i;
+   char c;
+
+   for (i = 0; i < appended->len; ++i) {
+      c = appended->str[i];
+      /* ignore UTF-8 non-ASCII chars, which have 1 in the top bit */
+      if ((c & (0x1U << 7U)) == 0) {
+         c = (char) tolower (c);
+      }
+
+      kms_request_sink_append_char (sink, c);
+   }
+}
+
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
+
+void
+kms_request_sink_append_escaped (kms_request_sink_t *sink,
+                                 const kms_request_str_t *appended,
+                                 bool escape_slash)
+{
+   const uint8_t *in = (const uint8_t *) appended->str;
+   size_t i;
+
+   tables_init ();
+
+   for (i = 0; i < appended->len; ++i) {
+      /* room for "%AB" */
+      if (sink->len + 3 > sizeof (sink->buf)) {
+         kms_request_sink_flush (sink);
+      }
+
+      if (rfc_3986_tab[in[i]] || (in[i] == '/' && !escape_slash)) {
+         sink->buf[sink->len++] = (char) in[i];
+      } else {
+         sink->buf[sink->len++] = '%';
+         sink->buf[sink->len++] = hex_upper[in[i] >> 4];
+         sink->buf[sink->len++] = hex_upper[in[i] & 0xf];
+      }
+   }
+}
+
+void
+kms_request_sink_append_stripped (kms_request_sink_t *sink,
+                                  const kms_request_str_t *appended)
+{
+   const char *src = appended->str;
+   const char *end = appended->str + appended->len;
+   bool space = false;
+   bool comma = false;
+
+   while (isspace (*src)) {
+      ++src;
+   }
+
+   while (src < end) {
+      /* replace newlines with commas. not documented but see
+       * get-header-value-multiline.creq */
+      if (*src == '\n') {
+         comma = true;
+         space = false;
+      } else if (isspace (*src)) {
+         space = true;
+      } else {
+         if (comma) {
+            kms_request_sink_append_char (sink, ',');
+            comma = false;
+            space = false;
+         }
+
+         /* is there a run of spaces waiting to be written as one space? */
+         if (space) {
+            kms_request_sink_append_char (sink, ' ');
+            space = false;
+         }
+
+         kms_request_sink_append_char (sink, *src);
+      }
+
+      ++src;
+   }
+}
+
+void
+kms_request_sink_append_hex (kms_request_sink_t *sink,
+                             const unsigned char *data,
+                             size_t len)
+{
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      if (sink->len + 2 > sizeof (sink->buf)) {
+         kms_request_sink_flush (sink);
+      }
+
+      sink->buf[sink->len++] = hex_lower[data[i] >> 4];
+      sink->buf[sink->len++] = hex_lower[data[i] & 0xf];
+   }
+}
@@ -17,6 +17,8 @@
 #ifndef KMS_MESSAGE_KMS_REQUEST_STR_H
 #define KMS_MESSAGE_KMS_REQUEST_STR_H
 
+#include "kms_arena.h"
+#include "kms_crypto.h"
 #include "kms_message/kms_message.h"
 
 #include <stdarg.h>
@@ -24,15 +26,25 @@
 #include <stdint.h>
 #include <string.h>
 
+/* strings shorter than this, like a date, region, or header name, are stored
+ * in the struct, so they take one allocation */
+#define KMS_REQUEST_STR_INLINE 32
+
 typedef struct {
+   /* "inline_buf" until the string outgrows it */
    char *str;
    size_t len;
    size_t size;
+   /* where it and "str" are allocated, NULL for malloc */
+   kms_arena_t *arena;
+   char inline_buf[KMS_REQUEST_STR_INLINE];
 } kms_request_str_t;
 
 KMS_MSG_EXPORT (kms_request_str_t *)
 kms_request_str_new (void);
 KMS_MSG_EXPORT (kms_request_str_t *)
+kms_request_str_new_in (kms_arena_t *arena);
+KMS_MSG_EXPORT (kms_request_str_t *)
 kms_request_str_new_from_chars (const char *chars, ssize_t len);
 KMS_MSG_EXPORT (kms_request_str_t *)
 kms_request_str_wrap (char *chars, ssize_t len);
@@ -42,6 +54,7 @@ KMS_MSG_EXPORT (char *)
 kms_request_str_detach (kms_request_str_t *str);
 KMS_MSG_EXPORT (bool)
 kms_request_str_reserve (kms_request_str_t *str, size_t size);
+/* a copy allocated with malloc, wherever "str" is */
 KMS_MSG_EXPORT (kms_request_str_t *)
 kms_request_str_dup (kms_request_str_t *str);
 KMS_MSG_EXPORT (void)
@@ -77,9 +90,59 @@ kms_request_str_append_hashed (kms_request_str_t *str,
                                kms_request_str_t *appended);
 KMS_MSG_EXPORT (bool)
 kms_request_str_append_hex (kms_request_str_t *str,
-                            unsigned char *data,
+                            const unsigned char *data,
                             size_t len);
 KMS_MSG_EXPORT (kms_request_str_t *)
 kms_request_str_path_normalized (kms_request_str_t *str);
 
+/* where the canonical request is written: appended to a string, or fed to a
+ * running SHA-256 so signing needn't hold the whole canonical request. output
+ * is buffered, call kms_request_sink_flush or kms_request_sink_final when
+ * done. */
+typedef struct {
+   kms_request_str_t *str; /* NULL when hashing */
+   bool hashing;
+   bool failed;
+   kms_sha256_state_t state;
+   size_t len;
+   char buf[256];
+} kms_request_sink_t;
+
+KMS_MSG_EXPORT (void)
+kms_request_sink_init_str (kms_request_sink_t *sink, kms_request_str_t *str);
+KMS_MSG_EXPORT (bool)
+kms_request_sink_init_sha256 (kms_request_sink_t *sink);
+/* appends the buffered output to the string, or hashes it */
+KMS_MSG_EXPORT (bool)
+kms_request_sink_flush (kms_request_sink_t *sink);
+/* flushes, and if hashing, writes the hash to "hash_out" */
+KMS_MSG_EXPORT (bool)
+kms_request_sink_final (kms_request_sink_t *sink, unsigned char *hash_out);
+/* releases the SHA-256 state after an error, before kms_request_sink_final */
+KMS_MSG_EXPORT (void)
+kms_request_sink_cleanup (kms_request_sink_t *sink);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append (kms_request_sink_t *sink,
+                         const kms_request_str_t *appended);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_char (kms_request_sink_t *sink, char c);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_chars (kms_request_sink_t *sink,
+                               const char *appended,
+                               ssize_t len);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_lowercase (kms_request_sink_t *sink,
+                                   const kms_request_str_t *appended);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_escaped (kms_request_sink_t *sink,
+                                 const kms_request_str_t *appended,
+                                 bool escape_slash);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_stripped (kms_request_sink_t *sink,
+                                  const kms_request_str_t *appended);
+KMS_MSG_EXPORT (void)
+kms_request_sink_append_hex (kms_request_sink_t *sink,
+                             const unsigned char *data,
+                             size_t len);
+
 #endif // KMS_MESSAGE_KMS_REQUEST_STR_H
@@ -15,10 +15,23 @@
  * limitations under the License.
  */
 
+#include "kms_alloc.h"
 #include "kms_message/kms_message.h"
 #include "kms_message_private.h"
 #include "kms_request_str.h"
 
+int
+kms_response_get_status (kms_response_t *response)
+{
+   return response->status;
+}
+
+const char *
+kms_response_get_body (kms_response_t *response)
+{
+   return response->body ? response->body->str : NULL;
+}
+
 void
 kms_response_destroy (kms_response_t *response)
 {
@@ -27,5 +40,5 @@ kms_response_destroy (kms_response_t *response)
    }
    kms_kv_list_destroy (response->headers);
    kms_request_str_destroy (response->body);
-   free (response);
+   kms_free (response);
 }
\ No newline at end of file
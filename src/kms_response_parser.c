@@ -1,3 +1,4 @@
+#include "kms_alloc.h"
 #include "kms_message/kms_response_parser.h"
 #include "kms_message_private.h"
 
@@ -12,6 +13,8 @@ _parser_destroy (kms_response_parser_t *parser)
 {
    kms_request_str_destroy (parser->raw_response);
    parser->raw_response = NULL;
+   kms_request_str_destroy (parser->spare_body);
+   parser->spare_body = NULL;
    parser->content_length = -1;
    kms_response_destroy (parser->response);
    parser->response = NULL;
@@ -22,18 +25,44 @@ static void
 _parser_init (kms_response_parser_t *parser)
 {
    parser->raw_response = kms_request_str_new ();
+   parser->spare_body = NULL;
    parser->content_length = -1;
-   parser->response = calloc (1, sizeof (kms_response_t));
+   parser->response = kms_calloc (1, sizeof (kms_response_t));
    parser->response->headers = kms_kv_list_new ();
    parser->state = PARSING_STATUS_LINE;
    parser->start = 0;
    parser->failed = false;
 }
 
+/* like _parser_destroy then _parser_init, but keeps the buffers */
+static void
+_parser_reset (kms_response_parser_t *parser)
+{
+   kms_request_str_set_chars (parser->raw_response, "", 0);
+   parser->content_length = -1;
+   if (parser->response) {
+      parser->response->status = 0;
+      kms_kv_list_clear (parser->response->headers);
+      /* no body until the next one is read */
+      if (parser->response->body) {
+         kms_request_str_destroy (parser->spare_body);
+         parser->spare_body = parser->response->body;
+         parser->response->body = NULL;
+      }
+   } else {
+      parser->response = kms_calloc (1, sizeof (kms_response_t));
+      parser->response->headers = kms_kv_list_new ();
+   }
+
+   parser->state = PARSING_STATUS_LINE;
+   parser->start = 0;
+   parser->failed = false;
+}
+
 kms_response_parser_t *
 kms_response_parser_new (void)
 {
-   kms_response_parser_t *parser = malloc (sizeof (kms_response_parser_t));
+   kms_response_parser_t *parser = kms_malloc (sizeof (kms_response_parser_t));
    _parser_init (parser);
    return parser;
 }
@@ -71,14 +100,15 @@ _parse_int (const char *str, int *result)
 static bool
 _parse_int_from_view (const char *str, int start, int end, int *result)
 {
-   char *num_str = malloc (end - start + 1);
-   bool ret;
+   char num_str[16];
+
+   if (end - start >= (int) sizeof (num_str)) {
+      return false;
+   }
 
-   strncpy (num_str, str + start, end - start);
+   memcpy (num_str, str + start, end - start);
    num_str[end - start] = '\0';
-   ret = _parse_int (num_str, result);
-   free (num_str);
-   return ret;
+   return _parse_int (num_str, result);
 }
 
 /* returns true if char is "linear white space". This *ignores* the folding case
@@ -128,8 +158,9 @@ _parse_line (kms_response_parser_t *parser, int end)
        * See https://tools.ietf.org/html/rfc822#section-3.1
        */
       int j;
-      kms_request_str_t *key;
-      kms_request_str_t *val;
+      int key_start;
+      int key_len;
+      const kms_kv_t *kv;
 
       if (i == end) {
          /* empty line, this signals the start of the body. */
@@ -146,7 +177,8 @@ _parse_line (kms_response_parser_t *parser, int end)
          return PARSING_DONE;
       }
 
-      key = kms_request_str_new_from_chars (raw + i, j - i);
+      key_start = i;
+      key_len = j - i;
 
       i = j + 1;
       /* remove leading and trailing whitespace from the value. */
@@ -162,18 +194,14 @@ _parse_line (kms_response_parser_t *parser, int end)
             break;
       }
 
-      if (i == j) {
-         val = kms_request_str_new ();
-      } else {
-         val = kms_request_str_new_from_chars (raw + i, j - i);
-      }
-
-      kms_kv_list_add (response->headers, key, val);
+      kms_kv_list_add_chars (
+         response->headers, raw + key_start, key_len, raw + i, j - i);
+      kv = &response->headers->kvs[response->headers->len - 1];
 
       /* if we have *not* read the Content-Length yet, check. */
       if (parser->content_length == -1 &&
-          strcmp (key->str, "Content-Length") == 0) {
-         if (!_parse_int (val->str, &parser->content_length)) {
+          strcmp (kv->key->str, "Content-Length") == 0) {
+         if (!_parse_int (kv->value->str, &parser->content_length)) {
             KMS_ERROR (parser, "Could not parse Content-Length header.");
             return PARSING_DONE;
          }
@@ -212,8 +240,16 @@ kms_response_parser_feed (kms_response_parser_t *parser,
 
          /* check if we have the entire body. */
          if (body_read == parser->content_length) {
-            parser->response->body = kms_request_str_new_from_chars (
-               raw->str + parser->start, parser->content_length);
+            if (!parser->response->body) {
+               parser->response->body = parser->spare_body
+                                           ? parser->spare_body
+                                           : kms_request_str_new ();
+               parser->spare_body = NULL;
+            }
+
+            kms_request_str_set_chars (parser->response->body,
+                                       raw->str + parser->start,
+                                       parser->content_length);
             parser->state = PARSING_DONE;
          }
 
@@ -235,15 +271,25 @@ kms_response_parser_get_response (kms_response_parser_t *parser)
    kms_response_t *response = parser->response;
 
    parser->response = NULL;
-   /* reset the parser. */
-   _parser_destroy (parser);
-   _parser_init (parser);
+   _parser_reset (parser);
    return response;
 }
 
+kms_response_t *
+kms_response_parser_peek_response (kms_response_parser_t *parser)
+{
+   return parser->response;
+}
+
+void
+kms_response_parser_reset (kms_response_parser_t *parser)
+{
+   _parser_reset (parser);
+}
+
 void
 kms_response_parser_destroy (kms_response_parser_t *parser)
 {
    _parser_destroy (parser);
-   free (parser);
+   kms_free (parser);
 }
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_clock.h"
+#include "kms_message/kms_message.h"
+#include "kms_message_private.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* error codes in the body of a 400 that mean "slow down" */
+static const char *throttling_errors[] = {
+   "ThrottlingException", "RequestLimitExceeded", "TooManyRequestsException"};
+
+kms_retry_t *
+kms_retry_new (int max_attempts, int64_t base_ms, int64_t max_ms)
+{
+   kms_retry_t *retry = kms_calloc (1, sizeof (kms_retry_t));
+
+   retry->max_attempts = max_attempts;
+   retry->base_ms = base_ms;
+   retry->max_ms = max_ms;
+   kms_retry_set_seed (retry, (uint64_t) time (NULL) ^ (uintptr_t) retry);
+   kms_retry_reset (retry);
+
+   return retry;
+}
+
+void
+kms_retry_destroy (kms_retry_t *retry)
+{
+   kms_free (retry);
+}
+
+void
+kms_retry_reset (kms_retry_t *retry)
+{
+   retry->attempts = 1;
+}
+
+void
+kms_retry_set_seed (kms_retry_t *retry, uint64_t seed)
+{
+   /* xorshift gets stuck at zero */
+   retry->rand_state = seed ? seed : 1;
+}
+
+/* xorshift64* */
+static uint64_t
+next_rand (kms_retry_t *retry)
+{
+   uint64_t x = retry->rand_state;
+
+   x ^= x >> 12;
+   x ^= x << 25;
+   x ^= x >> 27;
+   retry->rand_state = x;
+
+   return x * 2685821657736338717ULL;
+}
+
+bool
+kms_response_is_retryable (kms_response_t *response)
+{
+   size_t i;
+
+   if (response->status >= 500 || response->status == 429) {
+      return true;
+   }
+
+   if (response->status != 400 || !response->body) {
+      return false;
+   }
+
+   for (i = 0; i < sizeof (throttling_errors) / sizeof (char *); i++) {
+      if (strstr (response->body->str, throttling_errors[i])) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/* a random delay up to base_ms * 2^(retries - 1), capped at max_ms */
+static int64_t
+backoff_ms (kms_retry_t *retry, int retries)
+{
+   int64_t cap = retry->base_ms;
+
+   while (--retries > 0 && cap < retry->max_ms) {
+      cap *= 2;
+   }
+
+   if (cap > retry->max_ms) {
+      cap = retry->max_ms;
+   }
+
+   if (cap <= 0) {
+      return 0;
+   }
+
+   return (int64_t) (next_rand (retry) % ((uint64_t) cap + 1));
+}
+
+bool
+kms_retry_next (kms_retry_t *retry,
+                kms_request_t *request,
+                kms_response_t *response,
+                int64_t *delay_ms)
+{
+   struct tm tm;
+   time_t due;
+
+   if (!kms_response_is_retryable (response) ||
+       retry->attempts >= retry->max_attempts) {
+      return false;
+   }
+
+   *delay_ms = backoff_ms (retry, retry->attempts);
+   retry->attempts++;
+
+   /* date it when it'll be sent, rounded up to the second */
+   due = (time_t) (kms_clock_now () + (*delay_ms + 999) / 1000);
+   if (!gmtime_r (&due, &tm)) {
+      KMS_ERROR (request, "Could not format the current time");
+      return false;
+   }
+
+   return kms_request_resign (request, &tm);
+}
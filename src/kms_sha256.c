@@ -0,0 +1,825 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* SHA-256 per FIPS 180-4, so the library can sign without OpenSSL. On x86 the
+ * compression function uses the SHA extensions if the CPU has them, otherwise
+ * AVX2 and BMI2, otherwise portable C. kms_sha256_multi hashes independent
+ * messages in the lanes of AVX2 or AVX-512 registers. */
+
+#include "kms_crypto.h"
+#include "kms_sha256.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KMS_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t k256[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+   0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+   0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+   0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+   0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+   0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BSIG0(x) (ROTR (x, 2) ^ ROTR (x, 13) ^ ROTR (x, 22))
+#define BSIG1(x) (ROTR (x, 6) ^ ROTR (x, 11) ^ ROTR (x, 25))
+#define SSIG0(x) (ROTR (x, 7) ^ ROTR (x, 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR (x, 17) ^ ROTR (x, 19) ^ ((x) >> 10))
+
+#define LOAD32_BE(p)                                                     \
+   (((uint32_t) (p)[0] << 24) | ((uint32_t) (p)[1] << 16) |              \
+    ((uint32_t) (p)[2] << 8) | (uint32_t) (p)[3])
+
+/* the 64 rounds, given W[t] + K[t] for each round in "wk" */
+#define SHA256_ROUNDS(h, wk)                                           \
+   do {                                                                \
+      uint32_t _a = (h)[0], _b = (h)[1], _c = (h)[2], _d = (h)[3];     \
+      uint32_t _e = (h)[4], _f = (h)[5], _g = (h)[6], _h = (h)[7];     \
+      uint32_t _t1, _t2;                                               \
+      int _t;                                                          \
+      for (_t = 0; _t < 64; _t++) {                                    \
+         _t1 = _h + BSIG1 (_e) + CH (_e, _f, _g) + (wk)[_t];           \
+         _t2 = BSIG0 (_a) + MAJ (_a, _b, _c);                          \
+         _h = _g;                                                      \
+         _g = _f;                                                      \
+         _f = _e;                                                      \
+         _e = _d + _t1;                                                \
+         _d = _c;                                                      \
+         _c = _b;                                                      \
+         _b = _a;                                                      \
+         _a = _t1 + _t2;                                               \
+      }                                                                \
+      (h)[0] += _a;                                                    \
+      (h)[1] += _b;                                                    \
+      (h)[2] += _c;                                                    \
+      (h)[3] += _d;                                                    \
+      (h)[4] += _e;                                                    \
+      (h)[5] += _f;                                                    \
+      (h)[6] += _g;                                                    \
+      (h)[7] += _h;                                                    \
+   } while (0)
+
+static void
+compress_portable (uint32_t *h, const unsigned char *blocks, size_t n)
+{
+   uint32_t w[64];
+   int t;
+
+   for (; n > 0; n--, blocks += 64) {
+      for (t = 0; t < 16; t++) {
+         w[t] = LOAD32_BE (blocks + 4 * t);
+      }
+
+      for (t = 16; t < 64; t++) {
+         w[t] = SSIG1 (w[t - 2]) + w[t - 7] + SSIG0 (w[t - 15]) + w[t - 16];
+      }
+
+      for (t = 0; t < 64; t++) {
+         w[t] += k256[t];
+      }
+
+      SHA256_ROUNDS (h, w);
+   }
+}
+
+#ifdef KMS_SHA256_X86
+
+#define ROTR_V(x, n) \
+   _mm_or_si128 (_mm_srli_epi32 ((x), (n)), _mm_slli_epi32 ((x), 32 - (n)))
+#define SSIG0_V(x) \
+   _mm_xor_si128 (_mm_xor_si128 (ROTR_V (x, 7), ROTR_V (x, 18)), \
+                  _mm_srli_epi32 ((x), 3))
+#define SSIG1_V(x) \
+   _mm_xor_si128 (_mm_xor_si128 (ROTR_V (x, 17), ROTR_V (x, 19)), \
+                  _mm_srli_epi32 ((x), 10))
+
+/* computes the message schedule four words at a time in vector registers and
+ * lets the compiler use BMI2's rorx for the rounds */
+__attribute__ ((target ("avx2,bmi2"))) static void
+compress_avx2 (uint32_t *h, const unsigned char *blocks, size_t n)
+{
+   const __m128i bswap =
+      _mm_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+   uint32_t wk[64];
+   __m128i g0, g1, g2, g3, w15, w7, s1, tmp;
+   int t;
+
+   for (; n > 0; n--, blocks += 64) {
+      g0 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) blocks), bswap);
+      g1 = _mm_shuffle_epi8 (
+         _mm_loadu_si128 ((const __m128i *) (blocks + 16)), bswap);
+      g2 = _mm_shuffle_epi8 (
+         _mm_loadu_si128 ((const __m128i *) (blocks + 32)), bswap);
+      g3 = _mm_shuffle_epi8 (
+         _mm_loadu_si128 ((const __m128i *) (blocks + 48)), bswap);
+
+      _mm_storeu_si128 (
+         (__m128i *) &wk[0],
+         _mm_add_epi32 (g0, _mm_loadu_si128 ((const __m128i *) &k256[0])));
+      _mm_storeu_si128 (
+         (__m128i *) &wk[4],
+         _mm_add_epi32 (g1, _mm_loadu_si128 ((const __m128i *) &k256[4])));
+      _mm_storeu_si128 (
+         (__m128i *) &wk[8],
+         _mm_add_epi32 (g2, _mm_loadu_si128 ((const __m128i *) &k256[8])));
+      _mm_storeu_si128 (
+         (__m128i *) &wk[12],
+         _mm_add_epi32 (g3, _mm_loadu_si128 ((const __m128i *) &k256[12])));
+
+      /* g0..g3 hold W[t-16..t-1] */
+      for (t = 16; t < 64; t += 4) {
+         w15 = _mm_alignr_epi8 (g1, g0, 4); /* W[t-15..t-12] */
+         w7 = _mm_alignr_epi8 (g3, g2, 4);  /* W[t-7..t-4] */
+         tmp = _mm_add_epi32 (_mm_add_epi32 (g0, SSIG0_V (w15)), w7);
+
+         /* W[t] and W[t+1] need W[t-2] and W[t-1] */
+         s1 = _mm_shuffle_epi32 (g3, 0xFE);
+         tmp = _mm_add_epi32 (tmp, _mm_move_epi64 (SSIG1_V (s1)));
+
+         /* W[t+2] and W[t+3] need W[t] and W[t+1] */
+         s1 = _mm_shuffle_epi32 (tmp, 0x40);
+         tmp = _mm_add_epi32 (
+            tmp, _mm_unpackhi_epi64 (_mm_setzero_si128 (), SSIG1_V (s1)));
+
+         g0 = g1;
+         g1 = g2;
+         g2 = g3;
+         g3 = tmp;
+         _mm_storeu_si128 (
+            (__m128i *) &wk[t],
+            _mm_add_epi32 (tmp, _mm_loadu_si128 ((const __m128i *) &k256[t])));
+      }
+
+      SHA256_ROUNDS (h, wk);
+   }
+}
+
+/* the Intel SHA extensions, which do two rounds per sha256rnds2 */
+__attribute__ ((target ("sha,sse4.1"))) static void
+compress_shani (uint32_t *h, const unsigned char *blocks, size_t n)
+{
+   const __m128i bswap =
+      _mm_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+   __m128i state0, state1, abef_save, cdgh_save, tmp;
+   __m128i m[4];
+   int i;
+
+   /* h is ABCDEFGH, the instructions want ABEF and CDGH */
+   tmp = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &h[0]), 0xB1);
+   state1 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &h[4]), 0x1B);
+   state0 = _mm_alignr_epi8 (tmp, state1, 8);
+   state1 = _mm_blend_epi16 (state1, tmp, 0xF0);
+
+   for (; n > 0; n--, blocks += 64) {
+      abef_save = state0;
+      cdgh_save = state1;
+
+      /* m[i % 4] holds W[4i..4i+3] */
+      for (i = 0; i < 16; i++) {
+         if (i < 4) {
+            m[i] = _mm_shuffle_epi8 (
+               _mm_loadu_si128 ((const __m128i *) (blocks + 16 * i)), bswap);
+         } else {
+            tmp = _mm_sha256msg1_epu32 (m[i & 3], m[(i + 1) & 3]);
+            tmp = _mm_add_epi32 (
+               tmp, _mm_alignr_epi8 (m[(i + 3) & 3], m[(i + 2) & 3], 4));
+            m[i & 3] = _mm_sha256msg2_epu32 (tmp, m[(i + 3) & 3]);
+         }
+
+         tmp = _mm_add_epi32 (m[i & 3],
+                              _mm_loadu_si128 ((const __m128i *) &k256[4 * i]));
+         state1 = _mm_sha256rnds2_epu32 (state1, state0, tmp);
+         tmp = _mm_shuffle_epi32 (tmp, 0x0E);
+         state0 = _mm_sha256rnds2_epu32 (state0, state1, tmp);
+      }
+
+      state0 = _mm_add_epi32 (state0, abef_save);
+      state1 = _mm_add_epi32 (state1, cdgh_save);
+   }
+
+   tmp = _mm_shuffle_epi32 (state0, 0x1B);
+   state1 = _mm_shuffle_epi32 (state1, 0xB1);
+   state0 = _mm_blend_epi16 (tmp, state1, 0xF0);
+   state1 = _mm_alignr_epi8 (state1, tmp, 8);
+   _mm_storeu_si128 ((__m128i *) &h[0], state0);
+   _mm_storeu_si128 ((__m128i *) &h[4], state1);
+}
+
+/* compresses one block for each of "_lanes" messages, with the state in
+ * "h" as h[word * _lanes + lane]. ROTR and the sigma macros work unchanged on
+ * GCC vector types, one message per element. Lanes whose "active" word is
+ * zero are computed but not added into "h". */
+#define SHA256_LANES_BODY(_vec, _lanes)                                     \
+   do {                                                                     \
+      _vec _s[8], _w[64], _a, _b, _c, _d, _e, _f, _g, _h, _t1, _t2, _m;     \
+      int _t, _l;                                                           \
+      for (_t = 0; _t < 16; _t++) {                                         \
+         for (_l = 0; _l < (_lanes); _l++) {                                \
+            _w[_t][_l] = LOAD32_BE (blocks[_l] + 4 * _t);                   \
+         }                                                                  \
+      }                                                                     \
+      for (_t = 16; _t < 64; _t++) {                                        \
+         _w[_t] = SSIG1 (_w[_t - 2]) + _w[_t - 7] + SSIG0 (_w[_t - 15]) +   \
+                  _w[_t - 16];                                              \
+      }                                                                     \
+      for (_t = 0; _t < 8; _t++) {                                          \
+         memcpy (&_s[_t], h + _t * (_lanes), sizeof (_vec));                \
+      }                                                                     \
+      _a = _s[0];                                                           \
+      _b = _s[1];                                                           \
+      _c = _s[2];                                                           \
+      _d = _s[3];                                                           \
+      _e = _s[4];                                                           \
+      _f = _s[5];                                                           \
+      _g = _s[6];                                                           \
+      _h = _s[7];                                                           \
+      for (_t = 0; _t < 64; _t++) {                                         \
+         _t1 = _h + BSIG1 (_e) + CH (_e, _f, _g) + k256[_t] + _w[_t];       \
+         _t2 = BSIG0 (_a) + MAJ (_a, _b, _c);                               \
+         _h = _g;                                                           \
+         _g = _f;                                                           \
+         _f = _e;                                                           \
+         _e = _d + _t1;                                                     \
+         _d = _c;                                                           \
+         _c = _b;                                                           \
+         _b = _a;                                                           \
+         _a = _t1 + _t2;                                                    \
+      }                                                                     \
+      memcpy (&_m, active, sizeof (_vec));                                  \
+      _s[0] += _a & _m;                                                     \
+      _s[1] += _b & _m;                                                     \
+      _s[2] += _c & _m;                                                     \
+      _s[3] += _d & _m;                                                     \
+      _s[4] += _e & _m;                                                     \
+      _s[5] += _f & _m;                                                     \
+      _s[6] += _g & _m;                                                     \
+      _s[7] += _h & _m;                                                     \
+      for (_t = 0; _t < 8; _t++) {                                          \
+         memcpy (h + _t * (_lanes), &_s[_t], sizeof (_vec));                \
+      }                                                                     \
+   } while (0)
+
+typedef uint32_t kms_u32x8_t __attribute__ ((vector_size (32)));
+typedef uint32_t kms_u32x16_t __attribute__ ((vector_size (64)));
+
+__attribute__ ((target ("avx2"))) static void
+compress_x8_avx2 (uint32_t *h,
+                  const unsigned char *const *blocks,
+                  const uint32_t *active)
+{
+   SHA256_LANES_BODY (kms_u32x8_t, 8);
+}
+
+__attribute__ ((target ("avx512f"))) static void
+compress_x16_avx512 (uint32_t *h,
+                     const unsigned char *const *blocks,
+                     const uint32_t *active)
+{
+   SHA256_LANES_BODY (kms_u32x16_t, 16);
+}
+
+#define CPU_SHA (1U << 0)
+#define CPU_AVX2 (1U << 1)
+#define CPU_AVX512 (1U << 2)
+
+static unsigned int
+cpu_features (void)
+{
+   static bool resolved = false;
+   static unsigned int features = 0;
+   unsigned int eax, ebx, ecx, edx;
+   unsigned int ecx1;
+   unsigned int xcr0_lo = 0, xcr0_hi;
+
+   if (resolved) {
+      return features;
+   }
+
+   resolved = true;
+   if (__get_cpuid_max (0, NULL) < 7 ||
+       !__get_cpuid (1, &eax, &ebx, &ecx1, &edx)) {
+      return features;
+   }
+
+   __cpuid_count (7, 0, eax, ebx, ecx, edx);
+
+   /* the OS saves the vector registers (OSXSAVE, then XCR0) */
+   if (ecx1 & (1U << 27)) {
+      __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+   }
+
+   /* SHA, SSSE3, SSE4.1 */
+   if ((ebx & (1U << 29)) && (ecx1 & (1U << 9)) && (ecx1 & (1U << 19))) {
+      features |= CPU_SHA;
+   }
+
+   /* AVX2, BMI2, and ymm state */
+   if ((ebx & (1U << 5)) && (ebx & (1U << 8)) && (xcr0_lo & 0x6U) == 0x6U) {
+      features |= CPU_AVX2;
+   }
+
+   /* AVX-512F, and opmask, zmm and ymm state */
+   if ((ebx & (1U << 16)) && (xcr0_lo & 0xE6U) == 0xE6U) {
+      features |= CPU_AVX512;
+   }
+
+   return features;
+}
+
+static bool
+cpu_supports (kms_sha256_impl_t impl)
+{
+   switch (impl) {
+   case KMS_SHA256_PORTABLE:
+      return true;
+   case KMS_SHA256_SHANI:
+      return (cpu_features () & CPU_SHA) != 0;
+   case KMS_SHA256_AVX2:
+      return (cpu_features () & CPU_AVX2) != 0;
+   }
+
+   return false;
+}
+
+static bool
+cpu_supports_multi (kms_sha256_multi_impl_t impl)
+{
+   switch (impl) {
+   case KMS_SHA256_MULTI_SERIAL:
+      return true;
+   case KMS_SHA256_MULTI_AVX2:
+      return (cpu_features () & CPU_AVX2) != 0;
+   case KMS_SHA256_MULTI_AVX512:
+      return (cpu_features () & CPU_AVX512) != 0;
+   }
+
+   return false;
+}
+
+#else
+
+static bool
+cpu_supports (kms_sha256_impl_t impl)
+{
+   return impl == KMS_SHA256_PORTABLE;
+}
+
+static bool
+cpu_supports_multi (kms_sha256_multi_impl_t impl)
+{
+   return impl == KMS_SHA256_MULTI_SERIAL;
+}
+
+#endif /* KMS_SHA256_X86 */
+
+static bool impl_resolved = false;
+static kms_sha256_impl_t impl = KMS_SHA256_PORTABLE;
+
+bool
+kms_sha256_impl_supported (kms_sha256_impl_t i)
+{
+   return cpu_supports (i);
+}
+
+bool
+kms_sha256_set_impl (kms_sha256_impl_t i)
+{
+   if (!cpu_supports (i)) {
+      return false;
+   }
+
+   impl = i;
+   impl_resolved = true;
+   return true;
+}
+
+kms_sha256_impl_t
+kms_sha256_get_impl (void)
+{
+   if (!impl_resolved) {
+      if (cpu_supports (KMS_SHA256_SHANI)) {
+         impl = KMS_SHA256_SHANI;
+      } else if (cpu_supports (KMS_SHA256_AVX2)) {
+         impl = KMS_SHA256_AVX2;
+      } else {
+         impl = KMS_SHA256_PORTABLE;
+      }
+
+      impl_resolved = true;
+   }
+
+   return impl;
+}
+
+void
+kms_sha256_compress (uint32_t *h, const unsigned char *blocks, size_t n)
+{
+   switch (kms_sha256_get_impl ()) {
+#ifdef KMS_SHA256_X86
+   case KMS_SHA256_SHANI:
+      compress_shani (h, blocks, n);
+      return;
+   case KMS_SHA256_AVX2:
+      compress_avx2 (h, blocks, n);
+      return;
+#endif
+   default:
+      compress_portable (h, blocks, n);
+   }
+}
+
+static bool multi_impl_resolved = false;
+static kms_sha256_multi_impl_t multi_impl = KMS_SHA256_MULTI_SERIAL;
+
+bool
+kms_sha256_multi_impl_supported (kms_sha256_multi_impl_t i)
+{
+   return cpu_supports_multi (i);
+}
+
+bool
+kms_sha256_multi_set_impl (kms_sha256_multi_impl_t i)
+{
+   if (!cpu_supports_multi (i)) {
+      return false;
+   }
+
+   multi_impl = i;
+   multi_impl_resolved = true;
+   return true;
+}
+
+kms_sha256_multi_impl_t
+kms_sha256_multi_get_impl (void)
+{
+   if (!multi_impl_resolved) {
+      /* one message at a time with the SHA extensions beats eight at a time
+       * with AVX2, but not sixteen with AVX-512 */
+      if (cpu_supports_multi (KMS_SHA256_MULTI_AVX512)) {
+         multi_impl = KMS_SHA256_MULTI_AVX512;
+      } else if (cpu_supports (KMS_SHA256_SHANI)) {
+         multi_impl = KMS_SHA256_MULTI_SERIAL;
+      } else if (cpu_supports_multi (KMS_SHA256_MULTI_AVX2)) {
+         multi_impl = KMS_SHA256_MULTI_AVX2;
+      } else {
+         multi_impl = KMS_SHA256_MULTI_SERIAL;
+      }
+
+      multi_impl_resolved = true;
+   }
+
+   return multi_impl;
+}
+
+static const uint32_t initial_h[8] = {0x6a09e667,
+                                      0xbb67ae85,
+                                      0x3c6ef372,
+                                      0xa54ff53a,
+                                      0x510e527f,
+                                      0x9b05688c,
+                                      0x1f83d9ab,
+                                      0x5be0cd19};
+
+void
+kms_sha256_lane_init (kms_sha256_lane_t *lane,
+                      const unsigned char *msg,
+                      size_t len,
+                      unsigned char *hash_out)
+{
+   memcpy (lane->h, initial_h, sizeof (initial_h));
+   lane->prefix_len = 0;
+   lane->msg = msg;
+   lane->len = len;
+   lane->hash_out = hash_out;
+}
+
+/* the last one or two blocks of "lane": what's left of the message after its
+ * whole blocks, then the padding. returns the number of blocks. */
+static size_t
+lane_tail (const kms_sha256_lane_t *lane, unsigned char *tail)
+{
+   uint64_t bits = (lane->prefix_len + lane->len) * 8;
+   size_t used = lane->len % 64;
+   size_t n = used < 56 ? 1 : 2;
+   int i;
+
+   memcpy (tail, lane->msg + lane->len - used, used);
+   tail[used] = 0x80;
+   memset (tail + used + 1, 0, 64 * n - used - 1);
+   for (i = 0; i < 8; i++) {
+      tail[64 * n - 8 + i] = (unsigned char) (bits >> (56 - 8 * i));
+   }
+
+   return n;
+}
+
+static void
+store_hash (const uint32_t *h, size_t stride, unsigned char *hash_out)
+{
+   int i;
+
+   for (i = 0; i < 8; i++) {
+      hash_out[4 * i] = (unsigned char) (h[i * stride] >> 24);
+      hash_out[4 * i + 1] = (unsigned char) (h[i * stride] >> 16);
+      hash_out[4 * i + 2] = (unsigned char) (h[i * stride] >> 8);
+      hash_out[4 * i + 3] = (unsigned char) h[i * stride];
+   }
+}
+
+static void
+multi_serial (kms_sha256_lane_t *lanes, size_t n)
+{
+   unsigned char tail[128];
+   size_t i, tail_blocks;
+
+   for (i = 0; i < n; i++) {
+      tail_blocks = lane_tail (&lanes[i], tail);
+      kms_sha256_compress (lanes[i].h, lanes[i].msg, lanes[i].len / 64);
+      kms_sha256_compress (lanes[i].h, tail, tail_blocks);
+      store_hash (lanes[i].h, 1, lanes[i].hash_out);
+   }
+}
+
+#ifdef KMS_SHA256_X86
+
+typedef void (*compress_lanes_fn) (uint32_t *h,
+                                   const unsigned char *const *blocks,
+                                   const uint32_t *active);
+
+/* hashes up to "width" lanes together, as many blocks as the longest one */
+static void
+multi_group (kms_sha256_lane_t *lanes,
+             size_t n,
+             size_t width,
+             compress_lanes_fn compress)
+{
+   uint32_t h[8 * KMS_SHA256_MAX_LANES];
+   uint32_t active[KMS_SHA256_MAX_LANES];
+   const unsigned char *blocks[KMS_SHA256_MAX_LANES];
+   unsigned char tails[KMS_SHA256_MAX_LANES][128];
+   size_t whole[KMS_SHA256_MAX_LANES];
+   size_t total[KMS_SHA256_MAX_LANES];
+   size_t most = 0;
+   size_t b, l;
+   int i;
+
+   for (l = 0; l < width; l++) {
+      if (l < n) {
+         whole[l] = lanes[l].len / 64;
+         total[l] = whole[l] + lane_tail (&lanes[l], tails[l]);
+         for (i = 0; i < 8; i++) {
+            h[i * width + l] = lanes[l].h[i];
+         }
+      } else {
+         /* an idle lane hashes its zeroed tail and is never active */
+         whole[l] = total[l] = 0;
+         memset (tails[l], 0, 64);
+         for (i = 0; i < 8; i++) {
+            h[i * width + l] = 0;
+         }
+      }
+
+      if (total[l] > most) {
+         most = total[l];
+      }
+   }
+
+   for (b = 0; b < most; b++) {
+      for (l = 0; l < width; l++) {
+         if (b < whole[l]) {
+            blocks[l] = lanes[l].msg + 64 * b;
+         } else if (b < total[l]) {
+            blocks[l] = tails[l] + 64 * (b - whole[l]);
+         } else {
+            blocks[l] = tails[l];
+         }
+
+         active[l] = b < total[l] ? 0xFFFFFFFFU : 0;
+      }
+
+      compress (h, blocks, active);
+   }
+
+   for (l = 0; l < n; l++) {
+      store_hash (h + l, width, lanes[l].hash_out);
+   }
+}
+
+#endif /* KMS_SHA256_X86 */
+
+void
+kms_sha256_multi (kms_sha256_lane_t *lanes, size_t n)
+{
+#ifdef KMS_SHA256_X86
+   compress_lanes_fn compress;
+   size_t width, group;
+
+   switch (kms_sha256_multi_get_impl ()) {
+   case KMS_SHA256_MULTI_AVX512:
+      compress = compress_x16_avx512;
+      width = 16;
+      break;
+   case KMS_SHA256_MULTI_AVX2:
+      compress = compress_x8_avx2;
+      width = 8;
+      break;
+   default:
+      multi_serial (lanes, n);
+      return;
+   }
+
+   for (; n > 0; n -= group, lanes += group) {
+      group = n < width ? n : width;
+      multi_group (lanes, group, width, compress);
+   }
+#else
+   multi_serial (lanes, n);
+#endif
+}
+
+void
+kms_sha256_hmac_midstate (const unsigned char *key,
+                          size_t key_len,
+                          uint32_t *inner,
+                          uint32_t *outer)
+{
+   unsigned char block[64];
+   size_t i;
+
+   memcpy (inner, initial_h, sizeof (initial_h));
+   memcpy (outer, initial_h, sizeof (initial_h));
+
+   memset (block, 0x36, sizeof (block));
+   for (i = 0; i < key_len; i++) {
+      block[i] ^= key[i];
+   }
+
+   kms_sha256_compress (inner, block, 1);
+
+   memset (block, 0x5c, sizeof (block));
+   for (i = 0; i < key_len; i++) {
+      block[i] ^= key[i];
+   }
+
+   kms_sha256_compress (outer, block, 1);
+}
+
+void
+kms_sha256_builtin_init (kms_sha256_builtin_t *state)
+{
+   memcpy (state->h, initial_h, sizeof (initial_h));
+   state->len = 0;
+}
+
+void
+kms_sha256_builtin_update (kms_sha256_builtin_t *state,
+                           const void *input,
+                           size_t len)
+{
+   const unsigned char *p = input;
+   size_t used = (size_t) (state->len % 64);
+   size_t fill;
+
+   state->len += len;
+
+   if (used) {
+      fill = 64 - used;
+      if (len < fill) {
+         memcpy (state->buf + used, p, len);
+         return;
+      }
+
+      memcpy (state->buf + used, p, fill);
+      kms_sha256_compress (state->h, state->buf, 1);
+      p += fill;
+      len -= fill;
+   }
+
+   if (len >= 64) {
+      kms_sha256_compress (state->h, p, len / 64);
+      p += len - len % 64;
+      len %= 64;
+   }
+
+   if (len) {
+      memcpy (state->buf, p, len);
+   }
+}
+
+void
+kms_sha256_builtin_final (kms_sha256_builtin_t *state, unsigned char *hash_out)
+{
+   uint64_t bits = state->len * 8;
+   size_t used = (size_t) (state->len % 64);
+   int i;
+
+   state->buf[used++] = 0x80;
+   if (used > 56) {
+      memset (state->buf + used, 0, 64 - used);
+      kms_sha256_compress (state->h, state->buf, 1);
+      used = 0;
+   }
+
+   memset (state->buf + used, 0, 56 - used);
+   for (i = 0; i < 8; i++) {
+      state->buf[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+   }
+
+   kms_sha256_compress (state->h, state->buf, 1);
+   store_hash (state->h, 1, hash_out);
+}
+
+/* kms_crypto_t backend */
+
+typedef char builtin_state_fits[sizeof (kms_sha256_builtin_t) <=
+                                      sizeof (kms_sha256_state_t)
+                                   ? 1
+                                   : -1];
+
+#define BUILTIN(_state) ((kms_sha256_builtin_t *) (_state)->bytes)
+
+static bool
+builtin_sha256_init (kms_sha256_state_t *state)
+{
+   kms_sha256_builtin_init (BUILTIN (state));
+   return true;
+}
+
+static bool
+builtin_sha256_update (kms_sha256_state_t *state,
+                       const void *input,
+                       size_t len)
+{
+   kms_sha256_builtin_update (BUILTIN (state), input, len);
+   return true;
+}
+
+static bool
+builtin_sha256_final (kms_sha256_state_t *state, unsigned char *hash_out)
+{
+   kms_sha256_builtin_final (BUILTIN (state), hash_out);
+   return true;
+}
+
+static bool
+builtin_sha256_copy (kms_sha256_state_t *dst, const kms_sha256_state_t *src)
+{
+   memcpy (dst, src, sizeof (kms_sha256_builtin_t));
+   return true;
+}
+
+static void
+builtin_sha256_cleanup (kms_sha256_state_t *state)
+{
+   (void) state;
+}
+
+static bool
+builtin_backend_init (void)
+{
+   /* resolve now rather than on first use from several threads */
+   (void) kms_sha256_get_impl ();
+   (void) kms_sha256_multi_get_impl ();
+   return true;
+}
+
+static void
+builtin_backend_cleanup (void)
+{
+}
+
+const kms_crypto_t kms_crypto_builtin = {
+   "builtin",
+   builtin_backend_init,
+   builtin_backend_cleanup,
+   builtin_sha256_init,
+   builtin_sha256_update,
+   builtin_sha256_final,
+   builtin_sha256_copy,
+   builtin_sha256_cleanup,
+};
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KMS_MESSAGE_KMS_SHA256_H
+#define KMS_MESSAGE_KMS_SHA256_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* the built-in SHA-256 compression functions */
+typedef enum {
+   KMS_SHA256_PORTABLE,
+   KMS_SHA256_AVX2,
+   KMS_SHA256_SHANI
+} kms_sha256_impl_t;
+
+/* the state of the built-in backend */
+typedef struct {
+   uint32_t h[8];
+   uint64_t len; /* bytes absorbed, len % 64 of them are in buf */
+   unsigned char buf[64];
+} kms_sha256_builtin_t;
+
+void
+kms_sha256_builtin_init (kms_sha256_builtin_t *state);
+void
+kms_sha256_builtin_update (kms_sha256_builtin_t *state,
+                           const void *input,
+                           size_t len);
+void
+kms_sha256_builtin_final (kms_sha256_builtin_t *state,
+                          unsigned char *hash_out);
+/* compress "n" 64-byte blocks into "h" with the best implementation */
+void
+kms_sha256_compress (uint32_t *h, const unsigned char *blocks, size_t n);
+bool
+kms_sha256_impl_supported (kms_sha256_impl_t impl);
+/* for tests, returns false if the CPU doesn't support "impl" */
+bool
+kms_sha256_set_impl (kms_sha256_impl_t impl);
+kms_sha256_impl_t
+kms_sha256_get_impl (void);
+
+/* the implementations of kms_sha256_multi */
+typedef enum {
+   KMS_SHA256_MULTI_SERIAL, /* one message at a time, kms_sha256_compress */
+   KMS_SHA256_MULTI_AVX2,   /* eight messages at a time */
+   KMS_SHA256_MULTI_AVX512  /* sixteen messages at a time */
+} kms_sha256_multi_impl_t;
+
+#define KMS_SHA256_MAX_LANES 16
+
+/* one message for kms_sha256_multi. "h" is the state to start from and
+ * "prefix_len" the number of bytes, a multiple of 64, already compressed into
+ * it: for HMAC, the key midstate and 64. */
+typedef struct {
+   uint32_t h[8];
+   uint64_t prefix_len;
+   const unsigned char *msg;
+   size_t len;
+   unsigned char *hash_out;
+} kms_sha256_lane_t;
+
+/* starts from the SHA-256 initial state */
+void
+kms_sha256_lane_init (kms_sha256_lane_t *lane,
+                      const unsigned char *msg,
+                      size_t len,
+                      unsigned char *hash_out);
+/* hashes "n" independent messages, several at once if the CPU allows */
+void
+kms_sha256_multi (kms_sha256_lane_t *lanes, size_t n);
+/* the states after absorbing a key of up to 64 bytes xor ipad and opad */
+void
+kms_sha256_hmac_midstate (const unsigned char *key,
+                          size_t key_len,
+                          uint32_t *inner,
+                          uint32_t *outer);
+bool
+kms_sha256_multi_impl_supported (kms_sha256_multi_impl_t impl);
+/* for tests, returns false if the CPU doesn't support "impl" */
+bool
+kms_sha256_multi_set_impl (kms_sha256_multi_impl_t impl);
+kms_sha256_multi_impl_t
+kms_sha256_multi_get_impl (void);
+
+#endif /* KMS_MESSAGE_KMS_SHA256_H */
@@ -0,0 +1,415 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_message/kms_message.h"
+#include "kms_message_private.h"
+#include "kms_sha256.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef HANDLE thread_t;
+
+#define mutex_init(_m) InitializeCriticalSection (_m)
+#define mutex_lock(_m) EnterCriticalSection (_m)
+#define mutex_unlock(_m) LeaveCriticalSection (_m)
+#define mutex_destroy(_m) DeleteCriticalSection (_m)
+#define cond_init(_c) InitializeConditionVariable (_c)
+#define cond_wait(_c, _m) SleepConditionVariableCS (_c, _m, INFINITE)
+#define cond_signal(_c) WakeConditionVariable (_c)
+#define cond_broadcast(_c) WakeAllConditionVariable (_c)
+#define cond_destroy(_c) ((void) 0) /* nothing to free */
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t thread_t;
+
+#define mutex_init(_m) pthread_mutex_init (_m, NULL)
+#define mutex_lock(_m) pthread_mutex_lock (_m)
+#define mutex_unlock(_m) pthread_mutex_unlock (_m)
+#define mutex_destroy(_m) pthread_mutex_destroy (_m)
+#define cond_init(_c) pthread_cond_init (_c, NULL)
+#define cond_wait(_c, _m) pthread_cond_wait (_c, _m)
+#define cond_signal(_c) pthread_cond_signal (_c)
+#define cond_broadcast(_c) pthread_cond_broadcast (_c)
+#define cond_destroy(_c) pthread_cond_destroy (_c)
+#endif
+
+/* requests per task: enough to fill the SIMD lanes of kms_sha256_multi */
+#define CHUNK KMS_SHA256_MAX_LANES
+
+typedef struct {
+   kms_sign_pool_t *pool;
+   thread_t thread;
+   /* the chunks this worker has left, [next, end). others steal from the
+    * end */
+   mutex_t lock;
+   size_t next;
+   size_t end;
+   bool success;
+   /* scratch space, so signing allocates only the results */
+   kms_batch_item_t items[CHUNK];
+   kms_sha256_lane_t lanes[CHUNK];
+} worker_t;
+
+struct _kms_sign_pool_t {
+   int n_workers;
+   worker_t *workers; /* workers[0] is the calling thread */
+   mutex_t lock;
+   cond_t start;
+   cond_t done;
+   /* incremented for each batch, or -1 to stop the threads */
+   long generation;
+   int running;
+   /* the batch's requests that can be signed in parallel, and their results,
+    * kept to reuse */
+   kms_request_t **requests;
+   char **signed_out;
+   size_t *index;
+   size_t n;
+   size_t size;
+};
+
+/* take a chunk from our own range, or else steal half of another's */
+static bool
+take_chunk (worker_t *self, size_t *chunk)
+{
+   kms_sign_pool_t *pool = self->pool;
+   worker_t *victim;
+   size_t stolen;
+   int i;
+
+   mutex_lock (&self->lock);
+   if (self->next < self->end) {
+      *chunk = self->next++;
+      mutex_unlock (&self->lock);
+      return true;
+   }
+
+   mutex_unlock (&self->lock);
+
+   for (i = 1; i < pool->n_workers; i++) {
+      victim = &pool->workers[(self - pool->workers + i) % pool->n_workers];
+      mutex_lock (&victim->lock);
+      if (victim->next == victim->end) {
+         mutex_unlock (&victim->lock);
+         continue;
+      }
+
+      stolen = (victim->end - victim->next + 1) / 2;
+      victim->end -= stolen;
+      *chunk = victim->end;
+      mutex_unlock (&victim->lock);
+
+      /* only thieves touch an empty range, and only its owner fills it */
+      mutex_lock (&self->lock);
+      self->next = *chunk + 1;
+      self->end = *chunk + stolen;
+      mutex_unlock (&self->lock);
+      return true;
+   }
+
+   return false;
+}
+
+static void
+work (worker_t *self)
+{
+   kms_sign_pool_t *pool = self->pool;
+   size_t chunk;
+   size_t start;
+   size_t n;
+
+   while (take_chunk (self, &chunk)) {
+      start = chunk * CHUNK;
+      n = pool->n - start < CHUNK ? pool->n - start : CHUNK;
+      if (!kms_request_sign_batch_with (pool->requests + start,
+                                        n,
+                                        pool->signed_out + start,
+                                        self->items,
+                                        self->lanes)) {
+         self->success = false;
+      }
+   }
+}
+
+static void
+worker_loop (worker_t *self)
+{
+   kms_sign_pool_t *pool = self->pool;
+   long generation = 0;
+
+   for (;;) {
+      mutex_lock (&pool->lock);
+      while (pool->generation == generation) {
+         cond_wait (&pool->start, &pool->lock);
+      }
+
+      generation = pool->generation;
+      mutex_unlock (&pool->lock);
+      if (generation == -1) {
+         return;
+      }
+
+      work (self);
+
+      mutex_lock (&pool->lock);
+      if (--pool->running == 0) {
+         cond_signal (&pool->done);
+      }
+
+      mutex_unlock (&pool->lock);
+   }
+}
+
+#ifdef _WIN32
+
+static DWORD WINAPI
+worker_thread (LPVOID arg)
+{
+   worker_loop (arg);
+   return 0;
+}
+
+static bool
+thread_start (thread_t *thread, worker_t *worker)
+{
+   *thread = CreateThread (NULL, 0, worker_thread, worker, 0, NULL);
+   return *thread != NULL;
+}
+
+static void
+thread_join (thread_t thread)
+{
+   WaitForSingleObject (thread, INFINITE);
+   CloseHandle (thread);
+}
+
+static int
+n_cpus (void)
+{
+   SYSTEM_INFO info;
+
+   GetSystemInfo (&info);
+   return (int) info.dwNumberOfProcessors;
+}
+
+#else
+
+static void *
+worker_thread (void *arg)
+{
+   worker_loop (arg);
+   return NULL;
+}
+
+static bool
+thread_start (thread_t *thread, worker_t *worker)
+{
+   return 0 == pthread_create (thread, NULL, worker_thread, worker);
+}
+
+static void
+thread_join (thread_t thread)
+{
+   pthread_join (thread, NULL);
+}
+
+static int
+n_cpus (void)
+{
+   return (int) sysconf (_SC_NPROCESSORS_ONLN);
+}
+
+#endif /* _WIN32 */
+
+kms_sign_pool_t *
+kms_sign_pool_new (int n_threads)
+{
+   kms_sign_pool_t *pool = kms_calloc (1, sizeof (kms_sign_pool_t));
+   int i;
+
+   if (n_threads <= 0) {
+      n_threads = n_cpus ();
+      if (n_threads <= 0) {
+         n_threads = 1;
+      }
+   }
+
+   pool->n_workers = n_threads;
+   pool->workers = kms_calloc ((size_t) n_threads, sizeof (worker_t));
+   mutex_init (&pool->lock);
+   cond_init (&pool->start);
+   cond_init (&pool->done);
+
+   for (i = 0; i < n_threads; i++) {
+      pool->workers[i].pool = pool;
+      mutex_init (&pool->workers[i].lock);
+      if (i > 0 &&
+          !thread_start (&pool->workers[i].thread, &pool->workers[i])) {
+         /* sign with the threads we have */
+         mutex_destroy (&pool->workers[i].lock);
+         pool->n_workers = i;
+         break;
+      }
+   }
+
+   return pool;
+}
+
+void
+kms_sign_pool_destroy (kms_sign_pool_t *pool)
+{
+   int i;
+
+   if (!pool) {
+      return;
+   }
+
+   mutex_lock (&pool->lock);
+   pool->generation = -1;
+   cond_broadcast (&pool->start);
+   mutex_unlock (&pool->lock);
+
+   for (i = 0; i < pool->n_workers; i++) {
+      if (i > 0) {
+         thread_join (pool->workers[i].thread);
+      }
+
+      mutex_destroy (&pool->workers[i].lock);
+   }
+
+   mutex_destroy (&pool->lock);
+   cond_destroy (&pool->start);
+   cond_destroy (&pool->done);
+   kms_free (pool->workers);
+   kms_free (pool->requests);
+   kms_free (pool->signed_out);
+   kms_free (pool->index);
+   kms_free (pool);
+}
+
+static void
+reserve (kms_sign_pool_t *pool, size_t n)
+{
+   if (n <= pool->size) {
+      return;
+   }
+
+   pool->size = n;
+   pool->requests = kms_realloc (pool->requests, n * sizeof (kms_request_t *));
+   pool->signed_out = kms_realloc (pool->signed_out, n * sizeof (char *));
+   pool->index = kms_realloc (pool->index, n * sizeof (size_t));
+}
+
+/* a request whose signer would have to derive a key can't be signed while
+ * others read the signer */
+static bool
+reads_signer_only (const kms_request_t *request)
+{
+   return !request->signer ||
+          kms_signer_has_slot (
+             request->signer, request->date, request->datetime);
+}
+
+bool
+kms_sign_pool_sign (kms_sign_pool_t *pool,
+                    kms_request_t **requests,
+                    size_t n,
+                    char **signed_out)
+{
+   bool success = true;
+   size_t n_chunks;
+   size_t i, j;
+   int w;
+
+   reserve (pool, n);
+
+   /* derive signers' keys now, one thread at a time. the workers race to
+    * resolve the SHA-256 implementations otherwise */
+   (void) kms_sha256_multi_get_impl ();
+   for (i = 0; i < n; i++) {
+      signed_out[i] = NULL;
+      if (!requests[i]->failed && requests[i]->signer) {
+         (void) kms_signer_get_slot (
+            requests[i]->signer, requests[i]->date, requests[i]->datetime);
+      }
+   }
+
+   pool->n = 0;
+   for (i = 0; i < n; i++) {
+      if (reads_signer_only (requests[i])) {
+         pool->index[pool->n] = i;
+         pool->requests[pool->n++] = requests[i];
+      }
+   }
+
+   /* split the chunks evenly to start */
+   n_chunks = (pool->n + CHUNK - 1) / CHUNK;
+   for (w = 0; w < pool->n_workers; w++) {
+      pool->workers[w].next = n_chunks * (size_t) w / (size_t) pool->n_workers;
+      pool->workers[w].end =
+         n_chunks * (size_t) (w + 1) / (size_t) pool->n_workers;
+      pool->workers[w].success = true;
+   }
+
+   mutex_lock (&pool->lock);
+   pool->running = pool->n_workers - 1;
+   pool->generation++;
+   cond_broadcast (&pool->start);
+   mutex_unlock (&pool->lock);
+
+   work (&pool->workers[0]);
+
+   mutex_lock (&pool->lock);
+   while (pool->running > 0) {
+      cond_wait (&pool->done, &pool->lock);
+   }
+
+   mutex_unlock (&pool->lock);
+
+   for (w = 0; w < pool->n_workers; w++) {
+      success = success && pool->workers[w].success;
+   }
+
+   for (i = 0; i < pool->n; i++) {
+      signed_out[pool->index[i]] = pool->signed_out[i];
+   }
+
+   /* the rest, now that nothing else reads their signers */
+   for (i = 0, j = 0; i < n; i++) {
+      if (j < pool->n && pool->index[j] == i) {
+         j++;
+         continue;
+      }
+
+      if (!kms_request_sign_batch_with (requests + i,
+                                        1,
+                                        signed_out + i,
+                                        pool->workers[0].items,
+                                        pool->workers[0].lanes)) {
+         success = false;
+      }
+   }
+
+   return success;
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2018-present MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kms_alloc.h"
+#include "kms_crypto.h"
+#include "kms_message/kms_message.h"
+#include "kms_message_private.h"
+#include "kms_sha256.h"
+
+#include <stdio.h>
+
+/* derive tomorrow's key once the request time is this hour UTC or later */
+#define PREDERIVE_HOUR 23
+
+static void
+slot_init (kms_signer_slot_t *slot)
+{
+   slot->date[0] = '\0';
+   slot->hmac.initialized = false;
+   slot->scope = kms_request_str_new ();
+   slot->credential = kms_request_str_new ();
+}
+
+static void
+slot_cleanup (kms_signer_slot_t *slot)
+{
+   kms_hmac_sha256_key_cleanup (&slot->hmac);
+   kms_request_str_destroy (slot->scope);
+   kms_request_str_destroy (slot->credential);
+}
+
+kms_signer_t *
+kms_signer_new (const char *access_key_id,
+                const char *secret_key,
+                const char *region,
+                const char *service)
+{
+   kms_signer_t *signer = kms_calloc (1, sizeof (kms_signer_t));
+
+   signer->access_key_id = kms_request_str_new_from_chars (access_key_id, -1);
+   signer->secret_key = kms_request_str_new_from_chars (secret_key, -1);
+   signer->region = kms_request_str_new_from_chars (region, -1);
+   signer->service = kms_request_str_new_from_chars (service, -1);
+   slot_init (&signer->slots[0]);
+   slot_init (&signer->slots[1]);
+
+   return signer;
+}
+
+void
+kms_signer_destroy (kms_signer_t *signer)
+{
+   if (!signer) {
+      return;
+   }
+
+   kms_request_str_destroy (signer->access_key_id);
+   kms_request_str_destroy (signer->secret_key);
+   kms_request_str_destroy (signer->region);
+   kms_request_str_destroy (signer->service);
+   slot_cleanup (&signer->slots[0]);
+   slot_cleanup (&signer->slots[1]);
+   kms_free (signer);
+}
+
+bool
+kms_derive_signing_key (kms_request_str_t *secret_key,
+                        kms_request_str_t *date,
+                        kms_request_str_t *region,
+                        kms_request_str_t *service,
+                        unsigned char *key)
+{
+   bool success;
+   kms_request_str_t *aws4_plus_secret;
+   unsigned char k_date[32];
+   unsigned char k_region[32];
+   unsigned char k_service[32];
+
+   /* docs.aws.amazon.com/general/latest/gr/sigv4-calculate-signature.html
+    * Pseudocode for deriving a signing key
+    *
+    * kSecret = your secret access key
+    * kDate = HMAC("AWS4" + kSecret, Date)
+    * kRegion = HMAC(kDate, Region)
+    * kService = HMAC(kRegion, Service)
+    * kSigning = HMAC(kService, "aws4_request")
+    */
+   aws4_plus_secret = kms_request_str_new_from_chars ("AWS4", -1);
+   kms_request_str_append (aws4_plus_secret, secret_key);
+
+   success =
+      kms_sha256_hmac (aws4_plus_secret->str,
+                       aws4_plus_secret->len,
+                       date->str,
+                       date->len,
+                       k_date) &&
+      kms_sha256_hmac (
+         (char *) k_date, 32, region->str, region->len, k_region) &&
+      kms_sha256_hmac (
+         (char *) k_region, 32, service->str, service->len, k_service) &&
+      kms_sha256_hmac ((char *) k_service,
+                       32,
+                       "aws4_request",
+                       sizeof "aws4_request" - 1,
+                       key);
+
+   kms_request_str_destroy (aws4_plus_secret);
+
+   return success;
+}
+
+static bool
+is_leap_year (int year)
+{
+   return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* "20151231" -> "20160101" */
+static bool
+next_date (const char *date, char *out)
+{
+   static const int days_in_month[] = {
+      31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+   int year, month, day, last_day;
+
+   if (3 != sscanf (date, "%4d%2d%2d", &year, &month, &day) || month < 1 ||
+       month > 12) {
+      return false;
+   }
+
+   last_day = days_in_month[month - 1];
+   if (month == 2 && is_leap_year (year)) {
+      last_day = 29;
+   }
+
+   if (++day > last_day) {
+      day = 1;
+      if (++month > 12) {
+         month = 1;
+         ++year;
+      }
+   }
+
+   return 8 == sprintf (out, "%04d%02d%02d", year, month, day);
+}
+
+static bool
+slot_derive (kms_signer_t *signer, kms_signer_slot_t *slot, const char *date)
+{
+   kms_request_str_t *date_str;
+   bool success;
+
+   kms_hmac_sha256_key_cleanup (&slot->hmac);
+   date_str = kms_request_str_new_from_chars (date, -1);
+   success = kms_derive_signing_key (signer->secret_key,
+                                     date_str,
+                                     signer->region,
+                                     signer->service,
+                                     slot->key) &&
+             kms_hmac_sha256_key_init (
+                &slot->hmac, slot->key, sizeof (slot->key));
+
+   if (!success) {
+      slot->date[0] = '\0';
+      goto done;
+   }
+
+   kms_sha256_hmac_midstate (
+      slot->key, sizeof (slot->key), slot->hmac_inner, slot->hmac_outer);
+   memcpy (slot->date, date, sizeof slot->date);
+   slot->date[sizeof slot->date - 1] = '\0';
+
+   /* like "20150830/us-east-1/service/aws4_request" */
+   kms_request_str_set_chars (slot->scope, "", 0);
+   kms_request_str_append (slot->scope, date_str);
+   kms_request_str_append_char (slot->scope, '/');
+   kms_request_str_append (slot->scope, signer->region);
+   kms_request_str_append_char (slot->scope, '/');
+   kms_request_str_append (slot->scope, signer->service);
+   kms_request_str_append_chars (slot->scope, "/aws4_request", -1);
+
+   kms_request_str_set_chars (
+      slot->credential, "AWS4-HMAC-SHA256 Credential=", -1);
+   kms_request_str_append (slot->credential, signer->access_key_id);
+   kms_request_str_append_char (slot->credential, '/');
+   kms_request_str_append (slot->credential, slot->scope);
+
+done:
+   kms_request_str_destroy (date_str);
+   return success;
+}
+
+static kms_signer_slot_t *
+find_slot (const kms_signer_t *signer, const char *date)
+{
+   int i;
+
+   for (i = 0; i < 2; i++) {
+      if (0 == strcmp (signer->slots[i].date, date)) {
+         return (kms_signer_slot_t *) &signer->slots[i];
+      }
+   }
+
+   return NULL;
+}
+
+/* if "datetime" is within an hour of midnight and "other" isn't the next
+ * day's slot yet, the next day like "20150831" */
+static bool
+wants_next_day (const kms_signer_slot_t *other,
+                const kms_request_str_t *date,
+                const kms_request_str_t *datetime,
+                char *tomorrow)
+{
+   int hour;
+
+   return datetime->len > sizeof "YYYYmmDDTHH" - 1 &&
+          1 == sscanf (datetime->str + sizeof "YYYYmmDDT" - 1, "%2d", &hour) &&
+          hour >= PREDERIVE_HOUR && next_date (date->str, tomorrow) &&
+          0 != strcmp (other->date, tomorrow);
+}
+
+static const kms_signer_slot_t *
+other_slot (const kms_signer_t *signer, const kms_signer_slot_t *slot)
+{
+   return slot == &signer->slots[0] ? &signer->slots[1] : &signer->slots[0];
+}
+
+bool
+kms_signer_has_slot (const kms_signer_t *signer,
+                     const kms_request_str_t *date,
+                     const kms_request_str_t *datetime)
+{
+   const kms_signer_slot_t *slot;
+   char tomorrow[sizeof "YYYYmmDD"];
+
+   if (date->len != sizeof "YYYYmmDD" - 1) {
+      return false;
+   }
+
+   slot = find_slot (signer, date->str);
+   return slot &&
+          !wants_next_day (other_slot (signer, slot), date, datetime, tomorrow);
+}
+
+/* returns the cached key and scope for "date", deriving it on a miss. "date"
+ * is like "20150830", "datetime" like "20150830T123600Z". If "datetime" is
+ * within an hour of midnight, also derive the next day's key now so the first
+ * requests after midnight don't pay for it. */
+const kms_signer_slot_t *
+kms_signer_get_slot (kms_signer_t *signer,
+                     kms_request_str_t *date,
+                     kms_request_str_t *datetime)
+{
+   kms_signer_slot_t *slot;
+   kms_signer_slot_t *other;
+   char tomorrow[sizeof "YYYYmmDD"];
+
+   if (date->len != sizeof "YYYYmmDD" - 1) {
+      return NULL;
+   }
+
+   slot = find_slot (signer, date->str);
+   if (!slot) {
+      /* replace the older of the two */
+      slot = &signer->slots[0];
+      if (strcmp (signer->slots[1].date, slot->date) < 0) {
+         slot = &signer->slots[1];
+      }
+
+      if (!slot_derive (signer, slot, date->str)) {
+         return NULL;
+      }
+   }
+
+   other = (kms_signer_slot_t *) other_slot (signer, slot);
+   if (wants_next_day (other, date, datetime, tomorrow)) {
+      /* failure is not fatal, we'll try again on the next request */
+      (void) slot_derive (signer, other, tomorrow);
+   }
+
+   return slot;
+}